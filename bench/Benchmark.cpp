@@ -0,0 +1,604 @@
+#include "Mapper.h"
+#include "Map.h"
+#include "RAMCellManager.h"
+#include "HardDriveCellManager.h"
+#include "MappedSegmentCellManager.h"
+#include "CachedCellManager.h"
+#include "CellSerializer.h"
+#include <sys/resource.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace
+{
+	typedef PointMatcher<float> PM;
+	typedef std::chrono::steady_clock Clock;
+	using norlab_icp_mapper::Profiler;
+
+	const float CORRIDOR_HALF_WIDTH = 10.0;
+	const float CORRIDOR_HEIGHT = 5.0;
+	const unsigned RANDOM_SEED = 42;
+
+	typedef struct ReplayOptions
+	{
+		std::string sequenceFileName;
+		std::string inputFiltersConfigFilePath;
+		std::string icpConfigFilePath;
+		std::string mapPostFiltersConfigFilePath;
+		std::string mapUpdateCondition = "overlap";
+		float mapUpdateOverlap = 0.9;
+		float mapUpdateDelay = 1.0;
+		float mapUpdateDistance = 0.5;
+		float mapUpdateRotation = 0.2;
+		float mapUpdateNewPointRatio = 0.05;
+		float minDistNewPoint = 0.03;
+		float sensorMaxRange = 80.0;
+		bool computeProbDynamic = false;
+		std::string hardDriveCellFolder;
+		std::string hardDriveCellStore = "files";
+		float hardDriveCellCacheSize = 0;
+		float submapLength = 0;
+		float cellSize = 20.0;
+		int bufferSize = 2;
+		int nbThreads = 0;
+		float postFilterMargin = 2.0;
+		std::string traceFileName;
+	} ReplayOptions;
+
+	typedef struct Scan
+	{
+		double time;
+		std::string fileName;
+		PM::TransformationParameters pose;
+	} Scan;
+
+	void printUsage()
+	{
+		std::cerr << "usage: norlab_icp_mapper_bench replay <sequence file> [options]" << std::endl
+				  << "       norlab_icp_mapper_bench micro [cell folder] [number of iterations]" << std::endl
+				  << std::endl
+				  << "Each line of a sequence file holds a time in seconds, a scan file readable by libpointmatcher, relative to the sequence file," << std::endl
+				  << "and the row-major estimated pose of the sensor (9 values in 2D, 16 values in 3D)." << std::endl
+				  << std::endl
+				  << "replay options:" << std::endl
+				  << "  --input-filters <file>        --icp <file>                  --post-filters <file>" << std::endl
+				  << "  --map-update-condition <name> --map-update-overlap <value>  --map-update-delay <value>" << std::endl
+				  << "  --map-update-distance <value> --map-update-rotation <value> --map-update-new-point-ratio <value>" << std::endl
+				  << "  --min-dist-new-point <value>  --sensor-max-range <value>" << std::endl
+				  << "  --compute-prob-dynamic        --hard-drive-cells <folder>   --cell-store <files|segments|persistent>" << std::endl
+				  << "  --cell-cache-size <MB>        --submap-length <value>       --cell-size <value>" << std::endl
+				  << "  --buffer-size <cells>         --threads <count>             --post-filter-margin <value>" << std::endl
+				  << "  --trace <file>" << std::endl;
+	}
+
+	double toMilliseconds(const std::uint64_t& nanoseconds)
+	{
+		return nanoseconds / 1e6;
+	}
+
+	double getPeakResidentSetSize()
+	{
+		// in megabytes, ru_maxrss is in kilobytes on Linux
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_maxrss / 1024.0;
+	}
+
+	double computePercentile(std::vector<double> values, const double& percentile)
+	{
+		if(values.empty())
+		{
+			return 0;
+		}
+		std::sort(values.begin(), values.end());
+		const int rank = std::ceil(percentile / 100.0 * values.size());
+		return values[std::max(rank, 1) - 1];
+	}
+
+	void printStageStats(const Profiler::Stage& stage, const norlab_icp_mapper::StageStats& stats)
+	{
+		const double mean = stats.count > 0 ? toMilliseconds(stats.totalDuration) / stats.count : 0;
+		std::cout << "  " << std::left << std::setw(26) << Profiler::getStageName(stage) << std::right << std::setw(8) << stats.count
+				  << std::setw(12) << std::fixed << std::setprecision(3) << toMilliseconds(stats.totalDuration) << std::setw(10) << mean
+				  << std::setw(10) << toMilliseconds(stats.maxDuration) << std::endl;
+	}
+
+	void printStageStatsHeader()
+	{
+		std::cout << "  " << std::left << std::setw(26) << "stage" << std::right << std::setw(8) << "count" << std::setw(12) << "total (ms)"
+				  << std::setw(10) << "mean" << std::setw(10) << "max" << std::endl;
+	}
+
+	std::vector<Scan> loadSequence(const std::string& sequenceFileName)
+	{
+		std::ifstream ifs(sequenceFileName);
+		if(!ifs)
+		{
+			throw std::runtime_error("unable to read " + sequenceFileName + ".");
+		}
+		const std::size_t separator = sequenceFileName.find_last_of('/');
+		const std::string sequenceFolder = separator == std::string::npos ? "" : sequenceFileName.substr(0, separator + 1);
+
+		std::vector<Scan> scans;
+		std::string line;
+		while(std::getline(ifs, line))
+		{
+			if(line.empty() || line[0] == '#')
+			{
+				continue;
+			}
+			std::istringstream lineStream(line);
+			Scan scan;
+			lineStream >> scan.time >> scan.fileName;
+			std::vector<float> poseValues;
+			float poseValue;
+			while(lineStream >> poseValue)
+			{
+				poseValues.push_back(poseValue);
+			}
+			if(poseValues.size() != 9 && poseValues.size() != 16)
+			{
+				throw std::runtime_error("invalid pose in " + sequenceFileName + ": " + line + ", expected 9 or 16 values.");
+			}
+			const int poseDim = poseValues.size() == 9 ? 3 : 4;
+			scan.pose = PM::TransformationParameters(poseDim, poseDim);
+			for(int i = 0; i < poseValues.size(); i++)
+			{
+				scan.pose(i / poseDim, i % poseDim) = poseValues[i];
+			}
+			if(scan.fileName.empty() || scan.fileName[0] != '/')
+			{
+				scan.fileName = sequenceFolder + scan.fileName;
+			}
+			if(!scans.empty() && scans.front().pose.rows() != poseDim)
+			{
+				throw std::runtime_error("inconsistent pose dimensions in " + sequenceFileName + ".");
+			}
+			scans.push_back(scan);
+		}
+		if(scans.empty())
+		{
+			throw std::runtime_error("no scan in " + sequenceFileName + ".");
+		}
+		return scans;
+	}
+
+	ReplayOptions parseReplayOptions(const int& argc, char** argv)
+	{
+		ReplayOptions options;
+		options.sequenceFileName = argv[2];
+		for(int i = 3; i < argc; i++)
+		{
+			const std::string option = argv[i];
+			if(option == "--compute-prob-dynamic")
+			{
+				options.computeProbDynamic = true;
+				continue;
+			}
+			if(i + 1 >= argc)
+			{
+				throw std::runtime_error("missing value for option " + option + ".");
+			}
+			const std::string value = argv[++i];
+			if(option == "--input-filters")
+				options.inputFiltersConfigFilePath = value;
+			else if(option == "--icp")
+				options.icpConfigFilePath = value;
+			else if(option == "--post-filters")
+				options.mapPostFiltersConfigFilePath = value;
+			else if(option == "--map-update-condition")
+				options.mapUpdateCondition = value;
+			else if(option == "--map-update-overlap")
+				options.mapUpdateOverlap = std::stof(value);
+			else if(option == "--map-update-delay")
+				options.mapUpdateDelay = std::stof(value);
+			else if(option == "--map-update-distance")
+				options.mapUpdateDistance = std::stof(value);
+			else if(option == "--map-update-rotation")
+				options.mapUpdateRotation = std::stof(value);
+			else if(option == "--map-update-new-point-ratio")
+				options.mapUpdateNewPointRatio = std::stof(value);
+			else if(option == "--min-dist-new-point")
+				options.minDistNewPoint = std::stof(value);
+			else if(option == "--sensor-max-range")
+				options.sensorMaxRange = std::stof(value);
+			else if(option == "--hard-drive-cells")
+				options.hardDriveCellFolder = value;
+			else if(option == "--cell-store")
+				options.hardDriveCellStore = value;
+			else if(option == "--cell-cache-size")
+				options.hardDriveCellCacheSize = std::stof(value);
+			else if(option == "--submap-length")
+				options.submapLength = std::stof(value);
+			else if(option == "--cell-size")
+				options.cellSize = std::stof(value);
+			else if(option == "--buffer-size")
+				options.bufferSize = std::stoi(value);
+			else if(option == "--threads")
+				options.nbThreads = std::stoi(value);
+			else if(option == "--post-filter-margin")
+				options.postFilterMargin = std::stof(value);
+			else if(option == "--trace")
+				options.traceFileName = value;
+			else
+				throw std::runtime_error("invalid option: " + option + ".");
+		}
+		return options;
+	}
+
+	int replay(const ReplayOptions& options)
+	{
+		const std::vector<Scan> scans = loadSequence(options.sequenceFileName);
+		const bool is3D = scans.front().pose.rows() == 4;
+
+		// the mapper runs offline, so that map updates happen synchronously and replays are deterministic
+		norlab_icp_mapper::Mapper mapper(options.inputFiltersConfigFilePath, options.icpConfigFilePath, options.mapPostFiltersConfigFilePath,
+										 options.mapUpdateCondition, options.mapUpdateOverlap, options.mapUpdateDelay, options.mapUpdateDistance,
+										 options.minDistNewPoint, options.sensorMaxRange, 0.6, 0.9, 0.01, 0.01, 0.01, 0.8, 0.99, is3D, false,
+										 options.computeProbDynamic, true, !options.hardDriveCellFolder.empty(), false, "kdtree", options.hardDriveCellStore,
+										 options.hardDriveCellFolder, options.hardDriveCellCacheSize, 1, "block", options.mapUpdateRotation,
+										 options.mapUpdateNewPointRatio, options.submapLength, options.cellSize, options.bufferSize, options.nbThreads,
+										 options.postFilterMargin);
+		if(!options.traceFileName.empty())
+		{
+			mapper.startTrace(1 << 20);
+		}
+
+		std::vector<double> latencies;
+		std::uint64_t nbPoints = 0;
+		double totalDuration = 0;
+		for(const auto& scan: scans)
+		{
+			// scans are loaded outside of the measured time
+			const PM::DataPoints input = PM::DataPoints::load(scan.fileName);
+			const Clock::time_point timeStamp(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(scan.time)));
+
+			PM::DataPoints filteredInput;
+			const Clock::time_point start = Clock::now();
+			mapper.processInput(input, scan.pose, timeStamp, filteredInput);
+			const double latency = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+			latencies.push_back(latency);
+			totalDuration += latency;
+			nbPoints += input.getNbPoints();
+		}
+
+		const norlab_icp_mapper::MapperStats stats = mapper.getStats();
+		std::cout << std::fixed << std::setprecision(3);
+		std::cout << "scans: " << scans.size() << ", points: " << nbPoints << std::endl;
+		std::cout << "throughput: " << scans.size() / (totalDuration / 1000.0) << " scans/s, " << nbPoints / (totalDuration / 1000.0) << " points/s"
+				  << std::endl;
+		std::cout << "latency (ms): p50 " << computePercentile(latencies, 50) << ", p90 " << computePercentile(latencies, 90) << ", p99 "
+				  << computePercentile(latencies, 99) << ", max " << computePercentile(latencies, 100) << std::endl;
+		std::cout << "peak RSS: " << getPeakResidentSetSize() << " MB" << std::endl;
+		std::cout << "local map: " << stats.map.localPointCloudSize << " points in " << stats.map.nbLocalPointCloudCells << " cells" << std::endl;
+		std::cout << "cell swaps: " << stats.map.nbLoadedBytes / 1e6 << " MB loaded in " << toMilliseconds(stats.stages[Profiler::LOAD_CELLS].totalDuration)
+				  << " ms, " << stats.map.nbUnloadedBytes / 1e6 << " MB unloaded in "
+				  << toMilliseconds(stats.stages[Profiler::UNLOAD_CELLS].totalDuration) << " ms" << std::endl;
+		if(stats.cellMatcher.nbBuiltTrees > 0)
+		{
+			std::cout << "cell kd-trees: " << stats.cellMatcher.nbReusedTrees << " reused, " << stats.cellMatcher.nbBuiltTrees << " built" << std::endl;
+		}
+		printStageStatsHeader();
+		for(int i = 0; i < Profiler::NB_STAGES; i++)
+		{
+			printStageStats(static_cast<Profiler::Stage>(i), stats.stages[i]);
+		}
+
+		if(!options.traceFileName.empty())
+		{
+			mapper.stopTrace();
+			mapper.saveTrace(options.traceFileName);
+		}
+		return 0;
+	}
+
+	PM::DataPoints createPoints(const PM::Matrix& positions, const PM::Matrix& normals)
+	{
+		PM::DataPoints::Labels featureLabels;
+		featureLabels.push_back(PM::DataPoints::Label("x", 1));
+		featureLabels.push_back(PM::DataPoints::Label("y", 1));
+		featureLabels.push_back(PM::DataPoints::Label("z", 1));
+		featureLabels.push_back(PM::DataPoints::Label("pad", 1));
+		PM::DataPoints::Labels descriptorLabels;
+		descriptorLabels.push_back(PM::DataPoints::Label("normals", 3));
+
+		PM::Matrix features = PM::Matrix::Ones(4, positions.cols());
+		features.topRows(3) = positions;
+		return PM::DataPoints(features, featureLabels, normals, descriptorLabels);
+	}
+
+	// points on the ground and on the walls of a corridor going along the x axis, starting at the origin
+	PM::DataPoints generateCorridor(std::mt19937& randomNumberGenerator, const int& nbPoints, const float& length)
+	{
+		std::uniform_real_distribution<float> alongDistribution(0, length);
+		std::uniform_real_distribution<float> acrossDistribution(-CORRIDOR_HALF_WIDTH, CORRIDOR_HALF_WIDTH);
+		std::uniform_real_distribution<float> heightDistribution(0, CORRIDOR_HEIGHT);
+		std::uniform_int_distribution<int> surfaceDistribution(0, 2);
+
+		PM::Matrix positions(3, nbPoints);
+		PM::Matrix normals = PM::Matrix::Zero(3, nbPoints);
+		for(int i = 0; i < nbPoints; i++)
+		{
+			const int surface = surfaceDistribution(randomNumberGenerator);
+			positions(0, i) = alongDistribution(randomNumberGenerator);
+			if(surface == 0)
+			{
+				positions(1, i) = acrossDistribution(randomNumberGenerator);
+				positions(2, i) = 0;
+				normals(2, i) = 1;
+			}
+			else
+			{
+				positions(1, i) = surface == 1 ? -CORRIDOR_HALF_WIDTH : CORRIDOR_HALF_WIDTH;
+				positions(2, i) = heightDistribution(randomNumberGenerator);
+				normals(1, i) = surface == 1 ? 1 : -1;
+			}
+		}
+		return createPoints(positions, normals);
+	}
+
+	PM::DataPoints sampleScan(std::mt19937& randomNumberGenerator, const PM::DataPoints& world, const PM::Vector& sensorPosition, const float& range,
+							  const int& nbPoints)
+	{
+		std::vector<int> pointIdsWithinRange;
+		for(int i = 0; i < world.getNbPoints(); i++)
+		{
+			if((world.features.col(i).head(3) - sensorPosition).norm() < range)
+			{
+				pointIdsWithinRange.push_back(i);
+			}
+		}
+
+		std::uniform_int_distribution<int> pointIdDistribution(0, pointIdsWithinRange.size() - 1);
+		std::normal_distribution<float> noiseDistribution(0, 0.02);
+		PM::DataPoints scan = world.createSimilarEmpty(nbPoints);
+		for(int i = 0; i < nbPoints; i++)
+		{
+			scan.setColFrom(i, world, pointIdsWithinRange[pointIdDistribution(randomNumberGenerator)]);
+			for(int j = 0; j < 3; j++)
+			{
+				scan.features(j, i) += noiseDistribution(randomNumberGenerator);
+			}
+		}
+		return scan;
+	}
+
+	void benchmarkMap(const int& nbIterations)
+	{
+		const float sensorMaxRange = 40.0;
+		const float step = 5.0;
+		std::mt19937 randomNumberGenerator(RANDOM_SEED);
+		const PM::DataPoints world = generateCorridor(randomNumberGenerator, 400000, nbIterations * step + 2 * sensorMaxRange);
+		std::shared_ptr<PM::Transformation> transformation = PM::get().TransformationRegistrar.create("RigidTransformation");
+
+		Profiler profiler;
+		norlab_icp_mapper::ThreadPool threadPool(0);
+		norlab_icp_mapper::DoubleBufferedICP icp(profiler);
+		icp.setDefault();
+		norlab_icp_mapper::Map map(0.05, sensorMaxRange, 0.6, 0.9, 0.01, 0.01, 0.01, 0.8, 0.99, true, false, true, "kdtree", false, "files", "", 0, 0, 20.0,
+								   2, 2.0, profiler, threadPool, icp);
+
+		// the sensor moves along the corridor, so that cells are regularly unloaded and loaded
+		for(int i = 0; i < nbIterations; i++)
+		{
+			PM::TransformationParameters pose = PM::TransformationParameters::Identity(4, 4);
+			pose(0, 3) = sensorMaxRange + i * step;
+			pose(2, 3) = 1.0;
+			map.updatePose(pose, PM::Vector::Zero(3));
+
+			const PM::DataPoints scan = sampleScan(randomNumberGenerator, world, pose.topRightCorner(3, 1), sensorMaxRange, 20000);
+			map.updateLocalPointCloud(scan, pose, PM::DataPointsFilters());
+		}
+
+		std::cout << "map, " << nbIterations << " updates of 20000 points:" << std::endl;
+		printStageStatsHeader();
+		const Profiler::Stage stages[] = {Profiler::DYNAMIC_PROBABILITY, Profiler::MIN_DIST_INSERTION, Profiler::POST_FILTERS, Profiler::SET_MAP,
+										  Profiler::LOAD_CELLS, Profiler::UNLOAD_CELLS, Profiler::CELL_RETRIEVAL, Profiler::CELL_SAVING};
+		for(const auto& stage: stages)
+		{
+			printStageStats(stage, profiler.getStageStats(stage));
+		}
+	}
+
+	// appends the points of a part of a map grouped by cell, the way the map gives them to the ICP
+	void appendCellBlocks(const PM::DataPoints& part, const std::uint64_t& version, const float& cellSize, PM::DataPoints& points,
+						  std::vector<norlab_icp_mapper::ReferenceBlock>& blocks)
+	{
+		std::vector<std::pair<norlab_icp_mapper::CellId, int>> pointCellIds(part.getNbPoints());
+		for(int i = 0; i < part.getNbPoints(); i++)
+		{
+			pointCellIds[i] = std::make_pair(norlab_icp_mapper::toCellId(std::floor(part.features(0, i) / cellSize),
+																		 std::floor(part.features(1, i) / cellSize),
+																		 std::floor(part.features(2, i) / cellSize)), i);
+		}
+		std::sort(pointCellIds.begin(), pointCellIds.end());
+
+		PM::DataPoints sortedPart = part;
+		const int firstId = points.getNbPoints();
+		for(int i = 0; i < pointCellIds.size(); i++)
+		{
+			sortedPart.setColFrom(i, part, pointCellIds[i].second);
+			if(i == 0 || pointCellIds[i].first != pointCellIds[i - 1].first)
+			{
+				blocks.push_back(norlab_icp_mapper::ReferenceBlock{pointCellIds[i].first, 0, version, firstId + i, 0});
+			}
+			blocks.back().nbPoints++;
+		}
+
+		if(points.getNbPoints() == 0)
+		{
+			points = sortedPart;
+		}
+		else
+		{
+			points.concatenate(sortedPart);
+		}
+	}
+
+	// cells which did not change between two maps have to keep their kd-tree, even though the map mean given to the matcher moved, and both
+	// buffers have to share it
+	void checkCellMatcherReuse()
+	{
+		const std::string icpConfig = "matcher:\n"
+									  "  KDTreeMatcher:\n"
+									  "    knn: 1\n"
+									  "errorMinimizer:\n"
+									  "  PointToPointErrorMinimizer\n"
+									  "transformationCheckers:\n"
+									  "  - CounterTransformationChecker\n"
+									  "inspector:\n"
+									  "  NullInspector\n"
+									  "logger:\n"
+									  "  NullLogger\n";
+		std::mt19937 randomNumberGenerator(RANDOM_SEED);
+		const PM::DataPoints corridorPart = generateCorridor(randomNumberGenerator, 100000, 200.0);
+		PM::DataPoints extension = generateCorridor(randomNumberGenerator, 10000, 20.0);
+		extension.features.row(0).array() += 200.0;
+		PM::DataPoints corridor;
+		std::vector<norlab_icp_mapper::ReferenceBlock> corridorBlocks;
+		appendCellBlocks(corridorPart, 1, 20.0, corridor, corridorBlocks);
+		PM::DataPoints extendedCorridor = corridor;
+		std::vector<norlab_icp_mapper::ReferenceBlock> extendedCorridorBlocks = corridorBlocks;
+		appendCellBlocks(extension, 2, 20.0, extendedCorridor, extendedCorridorBlocks);
+
+		Profiler profiler;
+		norlab_icp_mapper::DoubleBufferedICP icp(profiler);
+		std::istringstream icpConfigStream(icpConfig);
+		icp.loadFromYaml(icpConfigStream);
+		icp.useCellMatcher(20.0);
+
+		// each map is set twice, so that it reaches both buffers
+		icp.setMap(corridor, corridorBlocks);
+		icp.setMap(corridor, corridorBlocks);
+		const norlab_icp_mapper::CellMatcherStats corridorStats = icp.getCellMatcherStats();
+		icp.setMap(extendedCorridor, extendedCorridorBlocks);
+		icp.setMap(extendedCorridor, extendedCorridorBlocks);
+		const norlab_icp_mapper::CellMatcherStats extendedCorridorStats = icp.getCellMatcherStats();
+
+		// every cell has to be indexed once, whichever buffer its map was set in
+		std::cout << "cell matcher: " << extendedCorridorStats.nbBuiltTrees << " kd-trees built and " << extendedCorridorStats.nbReusedTrees
+				  << " reused for " << extendedCorridorBlocks.size() << " cells" << std::endl;
+		if(corridorStats.nbBuiltTrees != corridorBlocks.size() || extendedCorridorStats.nbBuiltTrees != extendedCorridorBlocks.size())
+		{
+			throw std::runtime_error("the kd-trees of the unchanged cells were rebuilt when the map was extended or set in the other buffer.");
+		}
+	}
+
+	void benchmarkCellManager(const std::string& name, norlab_icp_mapper::CellManager& cellManager, const std::vector<PM::DataPoints>& cells)
+	{
+		std::vector<norlab_icp_mapper::CellId> cellIds;
+		std::size_t nbBytes = 0;
+		for(int i = 0; i < cells.size(); i++)
+		{
+			cellIds.push_back(norlab_icp_mapper::toCellId(i, 0, 0));
+			nbBytes += norlab_icp_mapper::CellSerializer::getSerializedSize(cells[i]);
+		}
+
+		std::vector<PM::DataPoints> cellsToSave = cells;
+		Clock::time_point start = Clock::now();
+		for(int i = 0; i < cellIds.size(); i++)
+		{
+			cellManager.saveCell(cellIds[i], std::move(cellsToSave[i]));
+		}
+		const double saveDuration = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		start = Clock::now();
+		cellManager.retrieveCells(cellIds);
+		const double retrieveDuration = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		start = Clock::now();
+		cellManager.takeCells(cellIds);
+		const double takeDuration = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+		const double megabytes = nbBytes / 1e6;
+		std::cout << "  " << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(3) << std::setw(12)
+				  << saveDuration / cells.size() << std::setw(10) << megabytes / (saveDuration / 1000.0) << std::setw(12)
+				  << retrieveDuration / cells.size() << std::setw(10) << megabytes / (retrieveDuration / 1000.0) << std::setw(12)
+				  << takeDuration / cells.size() << std::setw(10) << megabytes / (takeDuration / 1000.0) << std::endl;
+		cellManager.clearAllCells();
+	}
+
+	void benchmarkCellManagers(const std::string& cellFolder)
+	{
+		const int nbCells = 64;
+		const int nbPointsPerCell = 20000;
+		std::mt19937 randomNumberGenerator(RANDOM_SEED);
+		std::vector<PM::DataPoints> cells;
+		for(int i = 0; i < nbCells; i++)
+		{
+			cells.push_back(generateCorridor(randomNumberGenerator, nbPointsPerCell, 20.0));
+		}
+
+		std::string folderTemplate = cellFolder + "/norlab_icp_mapper_bench_XXXXXX";
+		if(mkdtemp(&folderTemplate[0]) == nullptr)
+		{
+			throw std::runtime_error("unable to create a folder in " + cellFolder + ".");
+		}
+		const std::string folder = folderTemplate;
+		norlab_icp_mapper::ThreadPool threadPool(0);
+
+		std::cout << "cell managers, " << nbCells << " cells of " << nbPointsPerCell << " points:" << std::endl;
+		std::cout << "  " << std::left << std::setw(20) << "backend" << std::right << std::setw(12) << "save (ms)" << std::setw(10) << "MB/s"
+				  << std::setw(12) << "retrieve" << std::setw(10) << "MB/s" << std::setw(12) << "take" << std::setw(10) << "MB/s" << std::endl;
+		{
+			norlab_icp_mapper::RAMCellManager cellManager;
+			benchmarkCellManager("ram", cellManager, cells);
+		}
+		{
+			norlab_icp_mapper::HardDriveCellManager cellManager(folder, threadPool);
+			benchmarkCellManager("files", cellManager, cells);
+		}
+		{
+			norlab_icp_mapper::MappedSegmentCellManager cellManager(folder, threadPool);
+			benchmarkCellManager("segments", cellManager, cells);
+		}
+		{
+			// the cache holds half of the cells
+			norlab_icp_mapper::CachedCellManager cellManager(
+					std::unique_ptr<norlab_icp_mapper::CellManager>(new norlab_icp_mapper::HardDriveCellManager(folder, threadPool)),
+					nbCells / 2 * norlab_icp_mapper::CellSerializer::getSerializedSize(cells.front()));
+			benchmarkCellManager("cached files", cellManager, cells);
+		}
+		rmdir(folder.c_str());
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if(argc < 2)
+	{
+		printUsage();
+		return 1;
+	}
+
+	try
+	{
+		const std::string mode = argv[1];
+		if(mode == "replay" && argc >= 3)
+		{
+			return replay(parseReplayOptions(argc, argv));
+		}
+		else if(mode == "micro")
+		{
+			const std::string cellFolder = argc >= 3 ? argv[2] : "/tmp";
+			const int nbIterations = argc >= 4 ? std::stoi(argv[3]) : 40;
+			checkCellMatcherReuse();
+			benchmarkMap(nbIterations);
+			benchmarkCellManagers(cellFolder);
+			return 0;
+		}
+		printUsage();
+		return 1;
+	}
+	catch(const std::exception& exception)
+	{
+		std::cerr << "error: " << exception.what() << std::endl;
+		return 1;
+	}
+}
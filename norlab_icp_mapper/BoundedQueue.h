@@ -0,0 +1,131 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <stdexcept>
+
+namespace norlab_icp_mapper
+{
+	// Blocking queue of limited capacity. When it is full, pushing either waits (block), drops the oldest item (dropOldest) or drops the pushed
+	// item (dropNewest). Dropped items are handed to a callback.
+	template<typename T>
+	class BoundedQueue
+	{
+	private:
+		enum Policy
+		{
+			BLOCK,
+			DROP_OLDEST,
+			DROP_NEWEST
+		};
+
+		const int capacity;
+		const Policy policy;
+		const std::function<void(T&)> dropCallback;
+		std::deque<T> items;
+		bool closed;
+		std::mutex itemsLock;
+		std::condition_variable itemsCondition;
+
+		static Policy parsePolicy(const std::string& policy)
+		{
+			if(policy == "block")
+			{
+				return BLOCK;
+			}
+			if(policy == "dropOldest")
+			{
+				return DROP_OLDEST;
+			}
+			if(policy == "dropNewest")
+			{
+				return DROP_NEWEST;
+			}
+			throw std::runtime_error("invalid queue policy: " + policy + ", expected block, dropOldest or dropNewest.");
+		}
+
+	public:
+		BoundedQueue(const int& capacity, const std::string& policy, const std::function<void(T&)>& dropCallback):
+				capacity(capacity),
+				policy(parsePolicy(policy)),
+				dropCallback(dropCallback),
+				closed(false)
+		{
+			if(capacity < 1)
+			{
+				throw std::runtime_error("invalid queue capacity: " + std::to_string(capacity) + ", expected at least 1.");
+			}
+		}
+
+		void push(T item)
+		{
+			std::unique_lock<std::mutex> itemsGuard(itemsLock);
+			if(policy == BLOCK)
+			{
+				itemsCondition.wait(itemsGuard, [this]
+				{
+					return items.size() < capacity || closed;
+				});
+			}
+
+			// items pushed after the queue was closed are dropped whatever the policy
+			if(closed || (policy == DROP_NEWEST && items.size() >= capacity))
+			{
+				itemsGuard.unlock();
+				dropCallback(item);
+				return;
+			}
+			if(policy == DROP_OLDEST && items.size() >= capacity)
+			{
+				T droppedItem = std::move(items.front());
+				items.pop_front();
+				items.push_back(std::move(item));
+				itemsGuard.unlock();
+				itemsCondition.notify_all();
+				dropCallback(droppedItem);
+				return;
+			}
+			items.push_back(std::move(item));
+			itemsGuard.unlock();
+			itemsCondition.notify_all();
+		}
+
+		// wait for an item, returns false once the queue is closed and empty
+		bool pop(T& item)
+		{
+			std::unique_lock<std::mutex> itemsGuard(itemsLock);
+			itemsCondition.wait(itemsGuard, [this]
+			{
+				return !items.empty() || closed;
+			});
+			if(items.empty())
+			{
+				return false;
+			}
+			item = std::move(items.front());
+			items.pop_front();
+			itemsGuard.unlock();
+			itemsCondition.notify_all();
+			return true;
+		}
+
+		std::size_t size()
+		{
+			std::lock_guard<std::mutex> itemsGuard(itemsLock);
+			return items.size();
+		}
+
+		void close()
+		{
+			itemsLock.lock();
+			closed = true;
+			itemsLock.unlock();
+			itemsCondition.notify_all();
+		}
+	};
+}
+
+#endif
@@ -0,0 +1,190 @@
+#include "CachedCellManager.h"
+#include <unordered_set>
+
+norlab_icp_mapper::CachedCellManager::CachedCellManager(std::unique_ptr<CellManager> cellManager, const std::size_t& capacity):
+		cellManager(std::move(cellManager)),
+		capacity(capacity),
+		size(0),
+		nbHits(0),
+		nbMisses(0),
+		nbEvictions(0)
+{
+}
+
+norlab_icp_mapper::CachedCellManager::~CachedCellManager()
+{
+	// the other cell manager cleans up its own cells, which a persistent one keeps
+	cachedCells.clear();
+	recencyList.clear();
+}
+
+std::vector<norlab_icp_mapper::CellId> norlab_icp_mapper::CachedCellManager::getAllCellIds() const
+{
+	std::unordered_set<CellId, CellIdHash> cellIds;
+	for(const auto& cachedCell: cachedCells)
+	{
+		cellIds.insert(cachedCell.first);
+	}
+	for(const auto& cellId: cellManager->getAllCellIds())
+	{
+		cellIds.insert(cellId);
+	}
+	return std::vector<CellId>(cellIds.begin(), cellIds.end());
+}
+
+void norlab_icp_mapper::CachedCellManager::saveCell(const CellId& cellId, const PM::DataPoints& cell)
+{
+	saveCell(cellId, PM::DataPoints(cell));
+}
+
+void norlab_icp_mapper::CachedCellManager::saveCell(const CellId& cellId, PM::DataPoints&& cell)
+{
+	auto oldCachedCell = cachedCells.find(cellId);
+	if(oldCachedCell != cachedCells.end())
+	{
+		size -= oldCachedCell->second.size;
+		recencyList.erase(oldCachedCell->second.recency);
+		cachedCells.erase(oldCachedCell);
+	}
+
+	const std::size_t cellSize = computeCellSize(cell);
+	recencyList.push_front(cellId);
+	cachedCells.emplace(cellId, CachedCell{std::move(cell), cellSize, recencyList.begin()});
+	size += cellSize;
+
+	// cells are only written back when they leave the cache
+	while(size > capacity && !recencyList.empty())
+	{
+		auto leastRecentlyUsedCell = cachedCells.find(recencyList.back());
+		size -= leastRecentlyUsedCell->second.size;
+		cellManager->saveCell(leastRecentlyUsedCell->first, std::move(leastRecentlyUsedCell->second.points));
+		cachedCells.erase(leastRecentlyUsedCell);
+		recencyList.pop_back();
+		nbEvictions++;
+	}
+}
+
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::CachedCellManager::retrieveCell(const CellId& cellId) const
+{
+	auto cachedCell = cachedCells.find(cellId);
+	if(cachedCell == cachedCells.end())
+	{
+		nbMisses++;
+		return cellManager->retrieveCell(cellId);
+	}
+
+	nbHits++;
+	recencyList.splice(recencyList.begin(), recencyList, cachedCell->second.recency);
+	return cachedCell->second.points;
+}
+
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::CachedCellManager::takeCell(const CellId& cellId)
+{
+	auto cachedCell = cachedCells.find(cellId);
+	if(cachedCell == cachedCells.end())
+	{
+		nbMisses++;
+		return cellManager->takeCell(cellId);
+	}
+
+	// the cell is loaded in the local map, which holds its most recent version until it is saved again
+	nbHits++;
+	PM::DataPoints cell = std::move(cachedCell->second.points);
+	size -= cachedCell->second.size;
+	recencyList.erase(cachedCell->second.recency);
+	cachedCells.erase(cachedCell);
+	return cell;
+}
+
+const norlab_icp_mapper::CellManager::PM::DataPoints* norlab_icp_mapper::CachedCellManager::viewCell(const CellId& cellId) const
+{
+	auto cachedCell = cachedCells.find(cellId);
+	return cachedCell != cachedCells.end() ? &cachedCell->second.points : cellManager->viewCell(cellId);
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::CachedCellManager::retrieveCells(const std::vector<CellId>& cellIds) const
+{
+	std::vector<PM::DataPoints> cells(cellIds.size());
+	std::vector<CellId> missedCellIds;
+	std::vector<int> missedCellIndices;
+	for(int i = 0; i < cellIds.size(); i++)
+	{
+		auto cachedCell = cachedCells.find(cellIds[i]);
+		if(cachedCell != cachedCells.end())
+		{
+			nbHits++;
+			recencyList.splice(recencyList.begin(), recencyList, cachedCell->second.recency);
+			cells[i] = cachedCell->second.points;
+		}
+		else
+		{
+			nbMisses++;
+			missedCellIds.push_back(cellIds[i]);
+			missedCellIndices.push_back(i);
+		}
+	}
+
+	std::vector<PM::DataPoints> missedCells = cellManager->retrieveCells(missedCellIds);
+	for(int i = 0; i < missedCells.size(); i++)
+	{
+		cells[missedCellIndices[i]] = std::move(missedCells[i]);
+	}
+	return cells;
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::CachedCellManager::takeCells(const std::vector<CellId>& cellIds)
+{
+	std::vector<PM::DataPoints> cells(cellIds.size());
+	std::vector<CellId> missedCellIds;
+	std::vector<int> missedCellIndices;
+	for(int i = 0; i < cellIds.size(); i++)
+	{
+		if(cachedCells.find(cellIds[i]) != cachedCells.end())
+		{
+			cells[i] = takeCell(cellIds[i]);
+		}
+		else
+		{
+			nbMisses++;
+			missedCellIds.push_back(cellIds[i]);
+			missedCellIndices.push_back(i);
+		}
+	}
+
+	std::vector<PM::DataPoints> missedCells = cellManager->takeCells(missedCellIds);
+	for(int i = 0; i < missedCells.size(); i++)
+	{
+		cells[missedCellIndices[i]] = std::move(missedCells[i]);
+	}
+	return cells;
+}
+
+void norlab_icp_mapper::CachedCellManager::clearAllCells()
+{
+	cachedCells.clear();
+	recencyList.clear();
+	size = 0;
+	cellManager->clearAllCells();
+}
+
+void norlab_icp_mapper::CachedCellManager::flush()
+{
+	for(auto& cachedCell: cachedCells)
+	{
+		cellManager->saveCell(cachedCell.first, std::move(cachedCell.second.points));
+	}
+	cachedCells.clear();
+	recencyList.clear();
+	size = 0;
+	cellManager->flush();
+}
+
+norlab_icp_mapper::CellCacheStats norlab_icp_mapper::CachedCellManager::getStats() const
+{
+	return CellCacheStats{nbHits.load(), nbMisses.load(), nbEvictions.load(), size.load()};
+}
+
+std::size_t norlab_icp_mapper::CachedCellManager::computeCellSize(const PM::DataPoints& cell) const
+{
+	return (cell.features.size() + cell.descriptors.size()) * sizeof(float) + cell.times.size() * sizeof(std::int64_t);
+}
@@ -0,0 +1,59 @@
+#ifndef CACHED_CELL_MANAGER_H
+#define CACHED_CELL_MANAGER_H
+
+#include "CellManager.h"
+#include <unordered_map>
+#include <list>
+#include <atomic>
+
+namespace norlab_icp_mapper
+{
+	typedef struct CellCacheStats
+	{
+		std::uint64_t nbHits;
+		std::uint64_t nbMisses;
+		std::uint64_t nbEvictions;
+		std::uint64_t size;
+	} CellCacheStats;
+
+	// Cell manager keeping the most recently saved cells in RAM, within a byte budget. Least recently used cells are written back to another cell
+	// manager when the budget is exceeded.
+	class CachedCellManager : public CellManager
+	{
+	private:
+		typedef struct CachedCell
+		{
+			PM::DataPoints points;
+			std::size_t size;
+			std::list<CellId>::iterator recency;
+		} CachedCell;
+
+		std::unique_ptr<CellManager> cellManager;
+		std::size_t capacity;
+		std::unordered_map<CellId, CachedCell, CellIdHash> cachedCells;
+		mutable std::list<CellId> recencyList;
+		std::atomic<std::size_t> size;
+		mutable std::atomic<std::uint64_t> nbHits;
+		mutable std::atomic<std::uint64_t> nbMisses;
+		std::atomic<std::uint64_t> nbEvictions;
+
+		std::size_t computeCellSize(const PM::DataPoints& cell) const;
+
+	public:
+		CachedCellManager(std::unique_ptr<CellManager> cellManager, const std::size_t& capacity);
+		~CachedCellManager() override;
+		std::vector<CellId> getAllCellIds() const override;
+		void saveCell(const CellId& cellId, const PM::DataPoints& cell) override;
+		PM::DataPoints retrieveCell(const CellId& cellId) const override;
+		void clearAllCells() override;
+		std::vector<PM::DataPoints> retrieveCells(const std::vector<CellId>& cellIds) const override;
+		std::vector<PM::DataPoints> takeCells(const std::vector<CellId>& cellIds) override;
+		void saveCell(const CellId& cellId, PM::DataPoints&& cell) override;
+		PM::DataPoints takeCell(const CellId& cellId) override;
+		const PM::DataPoints* viewCell(const CellId& cellId) const override;
+		void flush() override;
+		CellCacheStats getStats() const;
+	};
+}
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef CELL_ID_H
+#define CELL_ID_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace norlab_icp_mapper
+{
+	// Grid coordinates of a cell packed in 21 bits each, which covers 2^21 cells along each axis.
+	typedef std::uint64_t CellId;
+
+	inline CellId toCellId(const int& row, const int& column, const int& aisle)
+	{
+		const std::uint64_t mask = (1 << 21) - 1;
+		return ((static_cast<std::uint64_t>(row) & mask) << 42) | ((static_cast<std::uint64_t>(column) & mask) << 21) | (static_cast<std::uint64_t>(aisle) & mask);
+	}
+
+	inline int toRow(const CellId& cellId)
+	{
+		return static_cast<std::int64_t>(cellId << 1) >> 43;
+	}
+
+	inline int toColumn(const CellId& cellId)
+	{
+		return static_cast<std::int64_t>(cellId << 22) >> 43;
+	}
+
+	inline int toAisle(const CellId& cellId)
+	{
+		return static_cast<std::int64_t>(cellId << 43) >> 43;
+	}
+
+	struct CellIdHash
+	{
+		// splitmix64 finalizer, since packed ids of neighboring cells only differ in a few bits
+		std::size_t operator()(const CellId& cellId) const
+		{
+			std::uint64_t hash = cellId;
+			hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+			return hash ^ (hash >> 31);
+		}
+	};
+}
+
+#endif
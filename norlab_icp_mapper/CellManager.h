@@ -2,6 +2,7 @@
 #define CELL_MANAGER_H
 
 #include <pointmatcher/PointMatcher.h>
+#include "CellId.h"
 
 namespace norlab_icp_mapper
 {
@@ -12,10 +13,66 @@ namespace norlab_icp_mapper
 
 	public:
 		virtual ~CellManager() = default;
-		virtual std::vector<std::string> getAllCellIds() const = 0;
-		virtual void saveCell(const std::string& cellId, const PM::DataPoints& cell) = 0;
-		virtual PM::DataPoints retrieveCell(const std::string& cellId) const = 0;
+		virtual std::vector<CellId> getAllCellIds() const = 0;
+		virtual void saveCell(const CellId& cellId, const PM::DataPoints& cell) = 0;
+		virtual PM::DataPoints retrieveCell(const CellId& cellId) const = 0;
 		virtual void clearAllCells() = 0;
+
+		virtual void saveCell(const CellId& cellId, PM::DataPoints&& cell)
+		{
+			saveCell(cellId, static_cast<const PM::DataPoints&>(cell));
+		}
+
+		// retrieve a cell that is about to be loaded, the cell manager does not have to keep it afterwards
+		virtual PM::DataPoints takeCell(const CellId& cellId)
+		{
+			return retrieveCell(cellId);
+		}
+
+		// retrieve or take several cells at once, which lets backends do it concurrently
+		virtual std::vector<PM::DataPoints> retrieveCells(const std::vector<CellId>& cellIds) const
+		{
+			std::vector<PM::DataPoints> cells;
+			for(const auto& cellId: cellIds)
+			{
+				cells.push_back(retrieveCell(cellId));
+			}
+			return cells;
+		}
+
+		virtual std::vector<PM::DataPoints> takeCells(const std::vector<CellId>& cellIds)
+		{
+			std::vector<PM::DataPoints> cells;
+			for(const auto& cellId: cellIds)
+			{
+				cells.push_back(takeCell(cellId));
+			}
+			return cells;
+		}
+
+		virtual void saveCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>&& cells)
+		{
+			for(int i = 0; i < cellIds.size(); i++)
+			{
+				saveCell(cellIds[i], std::move(cells[i]));
+			}
+		}
+
+		// cell stored in memory, or nullptr when it has to be retrieved, valid until the cell manager is modified
+		virtual const PM::DataPoints* viewCell(const CellId&) const
+		{
+			return nullptr;
+		}
+
+		// hint that the cells will soon be retrieved, ignored by default
+		virtual void prefetchCells(const std::vector<CellId>&)
+		{
+		}
+
+		// write back the cells held in memory, so that a persistent cell store contains all the saved cells
+		virtual void flush()
+		{
+		}
 	};
 }
 
@@ -0,0 +1,314 @@
+#include "CellMatcher.h"
+
+norlab_icp_mapper::CellTreeStore::CellTreeStore():
+		nbReusedTrees(0),
+		nbBuiltTrees(0)
+{
+}
+
+std::shared_ptr<const norlab_icp_mapper::CellTreeStore::Tree> norlab_icp_mapper::CellTreeStore::findTree(const BlockKey& key, const std::uint64_t& version,
+																										  const int& nbPoints)
+{
+	std::lock_guard<std::mutex> treesLockGuard(treesLock);
+	auto tree = trees.find(key);
+	if(tree == trees.end() || tree->second->version != version || tree->second->features.cols() != nbPoints)
+	{
+		return nullptr;
+	}
+	nbReusedTrees++;
+	return tree->second;
+}
+
+std::shared_ptr<const norlab_icp_mapper::CellTreeStore::Tree> norlab_icp_mapper::CellTreeStore::buildTree(PM::Matrix features, const std::uint64_t& version,
+																										   const int& euclideanDim)
+{
+	std::shared_ptr<Tree> tree = std::make_shared<Tree>();
+	tree->version = version;
+	tree->features.swap(features);
+	tree->nns = std::shared_ptr<NNS>(NNS::create(tree->features, euclideanDim, NNS::KDTREE_LINEAR_HEAP));
+	nbBuiltTrees++;
+	return tree;
+}
+
+void norlab_icp_mapper::CellTreeStore::setTrees(Trees& newTrees)
+{
+	std::lock_guard<std::mutex> treesLockGuard(treesLock);
+	trees.swap(newTrees);
+}
+
+std::uint64_t norlab_icp_mapper::CellTreeStore::getNbReusedTrees() const
+{
+	return nbReusedTrees.load();
+}
+
+std::uint64_t norlab_icp_mapper::CellTreeStore::getNbBuiltTrees() const
+{
+	return nbBuiltTrees.load();
+}
+
+norlab_icp_mapper::CellMatcher::CellMatcher(const int& knn, const float& epsilon, const float& maxDist, const float& cellSize,
+											 const std::shared_ptr<CellTreeStore>& treeStore):
+		knn(knn),
+		epsilon(epsilon),
+		maxDist(maxDist),
+		cellSize(cellSize),
+		euclideanDim(0),
+		treeStore(treeStore)
+{
+}
+
+void norlab_icp_mapper::CellMatcher::setReferenceLayout(const PM::Vector& origin, const std::vector<ReferenceBlock>& blocks)
+{
+	referenceOrigin = origin;
+	referenceBlocks = blocks;
+}
+
+void norlab_icp_mapper::CellMatcher::init(const PM::DataPoints& filteredReference)
+{
+	euclideanDim = filteredReference.getEuclideanDim();
+	if(referenceOrigin.size() != euclideanDim)
+	{
+		referenceOrigin = PM::Vector::Zero(euclideanDim);
+	}
+
+	int nbBlockPoints = 0;
+	for(const auto& referenceBlock: referenceBlocks)
+	{
+		nbBlockPoints += referenceBlock.nbPoints;
+	}
+
+	std::unordered_map<CellId, Cell, CellIdHash> newCells;
+	CellTreeStore::Trees newTrees;
+	if(!referenceBlocks.empty() && nbBlockPoints == filteredReference.getNbPoints())
+	{
+		// reference filters keeping all the points are assumed to keep them in the same order, so only the points of the blocks whose version
+		// changed are read
+		for(const auto& referenceBlock: referenceBlocks)
+		{
+			if(referenceBlock.nbPoints == 0)
+			{
+				continue;
+			}
+
+			const CellTreeStore::BlockKey key(referenceBlock.source, referenceBlock.cellId);
+			std::shared_ptr<const Tree> tree = treeStore->findTree(key, referenceBlock.version, referenceBlock.nbPoints);
+			if(!tree)
+			{
+				tree = treeStore->buildTree(toOriginFrame(filteredReference.features.middleCols(referenceBlock.begin, referenceBlock.nbPoints)),
+											referenceBlock.version, euclideanDim);
+			}
+			newTrees[key] = tree;
+			getCell(newCells, referenceBlock.cellId).blocks.push_back(Block{tree, referenceBlock.begin, {}});
+		}
+	}
+	else
+	{
+		// without blocks, the points are partitioned into cells and every tree is built again
+		const PM::Matrix referenceFeatures = toOriginFrame(filteredReference.features);
+		std::unordered_map<CellId, std::vector<int>, CellIdHash> cellPointIds;
+		for(int i = 0; i < referenceFeatures.cols(); i++)
+		{
+			int row, column, aisle;
+			cellPointIds[computeCellId(referenceFeatures, i, row, column, aisle)].push_back(i);
+		}
+
+		for(auto& cellPoints: cellPointIds)
+		{
+			PM::Matrix cellFeatures(euclideanDim, cellPoints.second.size());
+			for(int i = 0; i < cellPoints.second.size(); i++)
+			{
+				cellFeatures.col(i) = referenceFeatures.col(cellPoints.second[i]);
+			}
+			std::shared_ptr<const Tree> tree = treeStore->buildTree(cellFeatures, 0, euclideanDim);
+			getCell(newCells, cellPoints.first).blocks.push_back(Block{tree, 0, std::move(cellPoints.second)});
+		}
+	}
+
+	// the layout only applies to the reference it was given for
+	referenceBlocks.clear();
+	treeStore->setTrees(newTrees);
+	cells.swap(newCells);
+}
+
+norlab_icp_mapper::CellMatcher::PM::Matches norlab_icp_mapper::CellMatcher::findClosests(const PM::DataPoints& filteredReading)
+{
+	const int nbPoints = filteredReading.getNbPoints();
+	const PM::Matrix readingFeatures = toOriginFrame(filteredReading.features);
+	PM::Matches matches(PM::Matches::Dists::Constant(knn, nbPoints, PM::Matches::InvalidDist),
+						PM::Matches::Ids::Constant(knn, nbPoints, PM::Matches::InvalidId));
+
+	std::vector<CellId> pointCellIds(nbPoints);
+	std::unordered_map<CellId, std::vector<int>, CellIdHash> cellPointIds;
+	for(int i = 0; i < nbPoints; i++)
+	{
+		int row, column, aisle;
+		pointCellIds[i] = computeCellId(readingFeatures, i, row, column, aisle);
+		cellPointIds[pointCellIds[i]].push_back(i);
+	}
+
+	// search the cell containing each point in batch
+	for(const auto& cellPoints: cellPointIds)
+	{
+		auto cell = cells.find(cellPoints.first);
+		if(cell == cells.end())
+		{
+			continue;
+		}
+
+		PM::Matrix query(euclideanDim, cellPoints.second.size());
+		for(int i = 0; i < cellPoints.second.size(); i++)
+		{
+			query.col(i) = readingFeatures.col(cellPoints.second[i]);
+		}
+		for(const auto& block: cell->second.blocks)
+		{
+			PM::Matches::Dists dists(knn, query.cols());
+			PM::Matches::Ids ids(knn, query.cols());
+			block.tree->nns->knn(query, ids, dists, knn, epsilon, NNS::ALLOW_SELF_MATCH | NNS::SORT_RESULTS, maxDist);
+			for(int i = 0; i < cellPoints.second.size(); i++)
+			{
+				mergeMatches(dists, ids, i, block, cellPoints.second[i], matches);
+			}
+		}
+	}
+
+	// points close to the border of their cell can have closer neighbors in the other cells
+	const int neighborhoodRange = std::isinf(maxDist) ? -1 : std::ceil(maxDist / cellSize);
+	const bool searchNeighborhood = neighborhoodRange >= 0 && std::pow(2 * neighborhoodRange + 1, euclideanDim) < cells.size();
+	for(int i = 0; i < nbPoints; i++)
+	{
+		auto ownCell = cells.find(pointCellIds[i]);
+		if(ownCell != cells.end() && std::sqrt(matches.dists(knn - 1, i)) <= computeDistanceToCellBorder(readingFeatures, i, ownCell->second))
+		{
+			continue;
+		}
+
+		if(searchNeighborhood)
+		{
+			int row, column, aisle;
+			computeCellId(readingFeatures, i, row, column, aisle);
+			const int aisleRange = euclideanDim == 3 ? neighborhoodRange : 0;
+			for(int j = row - neighborhoodRange; j <= row + neighborhoodRange; j++)
+			{
+				for(int k = column - neighborhoodRange; k <= column + neighborhoodRange; k++)
+				{
+					for(int l = aisle - aisleRange; l <= aisle + aisleRange; l++)
+					{
+						auto cell = cells.find(toCellId(j, k, l));
+						if(cell != cells.end() && cell->first != pointCellIds[i])
+						{
+							searchCell(readingFeatures, i, cell->second, matches);
+						}
+					}
+				}
+			}
+		}
+		else
+		{
+			for(const auto& cell: cells)
+			{
+				if(cell.first != pointCellIds[i])
+				{
+					searchCell(readingFeatures, i, cell.second, matches);
+				}
+			}
+		}
+	}
+
+	return matches;
+}
+
+norlab_icp_mapper::CellMatcher::PM::Matrix norlab_icp_mapper::CellMatcher::toOriginFrame(const PM::Matrix& features) const
+{
+	return features.topRows(euclideanDim).colwise() + referenceOrigin;
+}
+
+norlab_icp_mapper::CellId norlab_icp_mapper::CellMatcher::computeCellId(const PM::Matrix& features, const int& pointId, int& row, int& column, int& aisle) const
+{
+	row = std::floor(features(0, pointId) / cellSize);
+	column = std::floor(features(1, pointId) / cellSize);
+	aisle = euclideanDim == 3 ? std::floor(features(2, pointId) / cellSize) : 0;
+	return toCellId(row, column, aisle);
+}
+
+norlab_icp_mapper::CellMatcher::Cell& norlab_icp_mapper::CellMatcher::getCell(std::unordered_map<CellId, Cell, CellIdHash>& cells,
+																			   const CellId& cellId) const
+{
+	auto cell = cells.find(cellId);
+	if(cell == cells.end())
+	{
+		cell = cells.emplace(cellId, Cell{toRow(cellId), toColumn(cellId), toAisle(cellId), {}}).first;
+	}
+	return cell->second;
+}
+
+float norlab_icp_mapper::CellMatcher::computeDistanceToCellBorder(const PM::Matrix& features, const int& pointId, const Cell& cell) const
+{
+	const int cellCoordinates[3] = {cell.row, cell.column, cell.aisle};
+	float distance = std::numeric_limits<float>::infinity();
+	for(int i = 0; i < euclideanDim; i++)
+	{
+		const float inferiorBound = cellCoordinates[i] * cellSize;
+		distance = std::min(distance, std::min(features(i, pointId) - inferiorBound, inferiorBound + cellSize - features(i, pointId)));
+	}
+	return distance;
+}
+
+float norlab_icp_mapper::CellMatcher::computeDistanceToCell(const PM::Matrix& features, const int& pointId, const Cell& cell) const
+{
+	const int cellCoordinates[3] = {cell.row, cell.column, cell.aisle};
+	float squaredDistance = 0;
+	for(int i = 0; i < euclideanDim; i++)
+	{
+		const float inferiorBound = cellCoordinates[i] * cellSize;
+		const float delta = std::max(std::max(inferiorBound - features(i, pointId), features(i, pointId) - inferiorBound - cellSize), 0.0f);
+		squaredDistance += delta * delta;
+	}
+	return std::sqrt(squaredDistance);
+}
+
+void norlab_icp_mapper::CellMatcher::mergeMatches(const PM::Matches::Dists& dists, const PM::Matches::Ids& ids, const int& queryId, const Block& block,
+												  const int& pointId, PM::Matches& matches) const
+{
+	// merge the sorted neighbors of this block with the sorted neighbors found so far
+	PM::Matches::Dists mergedDists(knn, 1);
+	PM::Matches::Ids mergedIds(knn, 1);
+	int currentId = 0;
+	int newId = 0;
+	for(int i = 0; i < knn; i++)
+	{
+		if(newId < knn && dists(newId, queryId) < matches.dists(currentId, pointId))
+		{
+			const int localId = ids(newId, queryId);
+			mergedDists(i, 0) = dists(newId, queryId);
+			mergedIds(i, 0) = block.ids.empty() ? block.firstId + localId : block.ids[localId];
+			newId++;
+		}
+		else
+		{
+			mergedDists(i, 0) = matches.dists(currentId, pointId);
+			mergedIds(i, 0) = matches.ids(currentId, pointId);
+			currentId++;
+		}
+	}
+	matches.dists.col(pointId) = mergedDists;
+	matches.ids.col(pointId) = mergedIds;
+}
+
+void norlab_icp_mapper::CellMatcher::searchCell(const PM::Matrix& features, const int& pointId, const Cell& cell, PM::Matches& matches) const
+{
+	const float distanceToCell = computeDistanceToCell(features, pointId, cell);
+	if(distanceToCell > maxDist || distanceToCell * distanceToCell >= matches.dists(knn - 1, pointId))
+	{
+		return;
+	}
+
+	PM::Matrix query = features.col(pointId).head(euclideanDim);
+	for(const auto& block: cell.blocks)
+	{
+		PM::Matches::Dists dists(knn, 1);
+		PM::Matches::Ids ids(knn, 1);
+		block.tree->nns->knn(query, ids, dists, knn, epsilon, NNS::ALLOW_SELF_MATCH | NNS::SORT_RESULTS, maxDist);
+		mergeMatches(dists, ids, 0, block, pointId, matches);
+	}
+}
@@ -0,0 +1,123 @@
+#ifndef CELL_MATCHER_H
+#define CELL_MATCHER_H
+
+#include <pointmatcher/PointMatcher.h>
+#include <nabo/nabo.h>
+#include <unordered_map>
+#include <atomic>
+#include <mutex>
+#include "CellId.h"
+
+namespace norlab_icp_mapper
+{
+	// Contiguous points of a reference lying in one cell and coming from one source, the local map having source 0 and the frozen cells of
+	// submaps source 1. The points of a block keep the same positions as long as its version stays the same.
+	typedef struct ReferenceBlock
+	{
+		CellId cellId;
+		std::uint64_t source;
+		std::uint64_t version;
+		int begin;
+		int nbPoints;
+	} ReferenceBlock;
+
+	// Trees of the blocks of the latest reference, shared by the matchers of the ICP buffers so that a block is indexed once for both buffers.
+	// Trees are immutable once built, so matchers keep using theirs after the store moved to another reference.
+	class CellTreeStore
+	{
+	public:
+		typedef PointMatcher<float> PM;
+		typedef Nabo::NearestNeighbourSearch<float> NNS;
+		typedef std::pair<std::uint64_t, CellId> BlockKey;
+
+		struct BlockKeyHash
+		{
+			std::size_t operator()(const BlockKey& key) const
+			{
+				return CellIdHash()(key.second ^ (key.first * 0x9e3779b97f4a7c15ULL));
+			}
+		};
+
+		typedef struct Tree
+		{
+			std::uint64_t version;
+			PM::Matrix features;
+			std::shared_ptr<NNS> nns;
+		} Tree;
+
+		typedef std::unordered_map<BlockKey, std::shared_ptr<const Tree>, BlockKeyHash> Trees;
+
+	private:
+		Trees trees;
+		std::mutex treesLock;
+		std::atomic_ullong nbReusedTrees;
+		std::atomic_ullong nbBuiltTrees;
+
+	public:
+		CellTreeStore();
+		// tree of a block having the same version and size, null when there is none
+		std::shared_ptr<const Tree> findTree(const BlockKey& key, const std::uint64_t& version, const int& nbPoints);
+		std::shared_ptr<const Tree> buildTree(PM::Matrix features, const std::uint64_t& version, const int& euclideanDim);
+		// keep only the trees of the latest reference
+		void setTrees(Trees& newTrees);
+		std::uint64_t getNbReusedTrees() const;
+		std::uint64_t getNbBuiltTrees() const;
+	};
+
+	// Matcher keeping one kd-tree per block of the reference. When the reference changes, only the trees of the blocks whose version changed
+	// are rebuilt, the map giving the blocks of the next reference before it is set.
+	// The ICP gives the matcher points centered on the mean of the reference, which changes with every map, so trees are built after adding
+	// back the reference origin, which keeps them valid from one reference to the next.
+	class CellMatcher : public PointMatcher<float>::Matcher
+	{
+	private:
+		typedef PointMatcher<float> PM;
+		typedef Nabo::NearestNeighbourSearch<float> NNS;
+		typedef CellTreeStore::Tree Tree;
+
+		// ids of the points of the tree in the reference, which follow firstId when the list is empty
+		typedef struct Block
+		{
+			std::shared_ptr<const Tree> tree;
+			int firstId;
+			std::vector<int> ids;
+		} Block;
+
+		typedef struct Cell
+		{
+			int row;
+			int column;
+			int aisle;
+			std::vector<Block> blocks;
+		} Cell;
+
+		const int knn;
+		const float epsilon;
+		const float maxDist;
+		const float cellSize;
+		int euclideanDim;
+		PM::Vector referenceOrigin;
+		std::vector<ReferenceBlock> referenceBlocks;
+		std::shared_ptr<CellTreeStore> treeStore;
+		std::unordered_map<CellId, Cell, CellIdHash> cells;
+
+		PM::Matrix toOriginFrame(const PM::Matrix& features) const;
+		CellId computeCellId(const PM::Matrix& features, const int& pointId, int& row, int& column, int& aisle) const;
+		Cell& getCell(std::unordered_map<CellId, Cell, CellIdHash>& cells, const CellId& cellId) const;
+		float computeDistanceToCellBorder(const PM::Matrix& features, const int& pointId, const Cell& cell) const;
+		float computeDistanceToCell(const PM::Matrix& features, const int& pointId, const Cell& cell) const;
+		void mergeMatches(const PM::Matches::Dists& dists, const PM::Matches::Ids& ids, const int& queryId, const Block& block, const int& pointId,
+						  PM::Matches& matches) const;
+		void searchCell(const PM::Matrix& features, const int& pointId, const Cell& cell, PM::Matches& matches) const;
+
+	public:
+		CellMatcher(const int& knn, const float& epsilon, const float& maxDist, const float& cellSize, const std::shared_ptr<CellTreeStore>& treeStore);
+		// layout of the next reference: position of its origin in the map frame, which is the mean of the map given to the ICP, and its blocks,
+		// which can be empty when the reference is not made of blocks
+		void setReferenceLayout(const PM::Vector& origin, const std::vector<ReferenceBlock>& blocks);
+		void init(const PM::DataPoints& filteredReference) override;
+		PM::Matches findClosests(const PM::DataPoints& filteredReading) override;
+	};
+}
+
+#endif
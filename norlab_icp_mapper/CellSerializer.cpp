@@ -0,0 +1,88 @@
+#include "CellSerializer.h"
+#include <algorithm>
+
+const char norlab_icp_mapper::CellSerializer::MAGIC[4] = {'N', 'I', 'M', 'C'};
+const std::uint32_t norlab_icp_mapper::CellSerializer::VERSION = 1;
+
+void norlab_icp_mapper::CellSerializer::write(std::ostream& os, const PM::DataPoints& cell)
+{
+	os.write(MAGIC, sizeof(MAGIC));
+	writeValue(os, VERSION);
+	writeValue(os, static_cast<std::uint64_t>(cell.getNbPoints()));
+	writeLabels(os, cell.featureLabels);
+	writeLabels(os, cell.descriptorLabels);
+	writeLabels(os, cell.timeLabels);
+	os.write(reinterpret_cast<const char*>(cell.features.data()), cell.features.size() * sizeof(float));
+	os.write(reinterpret_cast<const char*>(cell.descriptors.data()), cell.descriptors.size() * sizeof(float));
+	os.write(reinterpret_cast<const char*>(cell.times.data()), cell.times.size() * sizeof(std::int64_t));
+	if(!os)
+	{
+		throw std::runtime_error("unable to write cell.");
+	}
+}
+
+norlab_icp_mapper::CellSerializer::PM::DataPoints norlab_icp_mapper::CellSerializer::read(std::istream& is)
+{
+	char magic[sizeof(MAGIC)];
+	is.read(magic, sizeof(magic));
+	if(!is || !std::equal(magic, magic + sizeof(magic), MAGIC) || readValue<std::uint32_t>(is) != VERSION)
+	{
+		throw std::runtime_error("invalid cell header.");
+	}
+	const std::uint64_t nbPoints = readValue<std::uint64_t>(is);
+	const PM::DataPoints::Labels featureLabels = readLabels(is);
+	const PM::DataPoints::Labels descriptorLabels = readLabels(is);
+	const PM::DataPoints::Labels timeLabels = readLabels(is);
+
+	// the matrices are read straight into the point cloud, without any parsing
+	PM::DataPoints cell(featureLabels, descriptorLabels, timeLabels, nbPoints);
+	is.read(reinterpret_cast<char*>(cell.features.data()), cell.features.size() * sizeof(float));
+	is.read(reinterpret_cast<char*>(cell.descriptors.data()), cell.descriptors.size() * sizeof(float));
+	is.read(reinterpret_cast<char*>(cell.times.data()), cell.times.size() * sizeof(std::int64_t));
+	if(!is)
+	{
+		throw std::runtime_error("truncated cell.");
+	}
+	return cell;
+}
+
+std::size_t norlab_icp_mapper::CellSerializer::getSerializedSize(const PM::DataPoints& cell)
+{
+	return sizeof(MAGIC) + sizeof(VERSION) + sizeof(std::uint64_t) + getSerializedSize(cell.featureLabels) + getSerializedSize(cell.descriptorLabels) +
+		   getSerializedSize(cell.timeLabels) + (cell.features.size() + cell.descriptors.size()) * sizeof(float) + cell.times.size() * sizeof(std::int64_t);
+}
+
+void norlab_icp_mapper::CellSerializer::writeLabels(std::ostream& os, const PM::DataPoints::Labels& labels)
+{
+	writeValue(os, static_cast<std::uint32_t>(labels.size()));
+	for(const auto& label: labels)
+	{
+		writeValue(os, static_cast<std::uint32_t>(label.text.size()));
+		os.write(label.text.data(), label.text.size());
+		writeValue(os, static_cast<std::uint32_t>(label.span));
+	}
+}
+
+norlab_icp_mapper::CellSerializer::PM::DataPoints::Labels norlab_icp_mapper::CellSerializer::readLabels(std::istream& is)
+{
+	PM::DataPoints::Labels labels;
+	const std::uint32_t nbLabels = readValue<std::uint32_t>(is);
+	for(std::uint32_t i = 0; i < nbLabels && is; i++)
+	{
+		std::string text(readValue<std::uint32_t>(is), ' ');
+		is.read(&text[0], text.size());
+		const std::uint32_t span = readValue<std::uint32_t>(is);
+		labels.push_back(PM::DataPoints::Label(text, span));
+	}
+	return labels;
+}
+
+std::size_t norlab_icp_mapper::CellSerializer::getSerializedSize(const PM::DataPoints::Labels& labels)
+{
+	std::size_t size = sizeof(std::uint32_t);
+	for(const auto& label: labels)
+	{
+		size += 2 * sizeof(std::uint32_t) + label.text.size();
+	}
+	return size;
+}
@@ -0,0 +1,43 @@
+#ifndef CELL_SERIALIZER_H
+#define CELL_SERIALIZER_H
+
+#include <pointmatcher/PointMatcher.h>
+#include <iostream>
+
+namespace norlab_icp_mapper
+{
+	// Binary cell format: a header with the point count and the labels, followed by the raw feature, descriptor and time matrices.
+	class CellSerializer
+	{
+	private:
+		typedef PointMatcher<float> PM;
+
+		static const char MAGIC[4];
+		static const std::uint32_t VERSION;
+
+		static void writeLabels(std::ostream& os, const PM::DataPoints::Labels& labels);
+		static PM::DataPoints::Labels readLabels(std::istream& is);
+		static std::size_t getSerializedSize(const PM::DataPoints::Labels& labels);
+
+		template<typename T>
+		static void writeValue(std::ostream& os, const T& value)
+		{
+			os.write(reinterpret_cast<const char*>(&value), sizeof(T));
+		}
+
+		template<typename T>
+		static T readValue(std::istream& is)
+		{
+			T value = T();
+			is.read(reinterpret_cast<char*>(&value), sizeof(T));
+			return value;
+		}
+
+	public:
+		static void write(std::ostream& os, const PM::DataPoints& cell);
+		static PM::DataPoints read(std::istream& is);
+		static std::size_t getSerializedSize(const PM::DataPoints& cell);
+	};
+}
+
+#endif
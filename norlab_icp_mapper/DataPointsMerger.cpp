@@ -0,0 +1,72 @@
+#include "DataPointsMerger.h"
+
+norlab_icp_mapper::DataPointsMerger::PM::DataPoints norlab_icp_mapper::DataPointsMerger::merge(const std::vector<const PM::DataPoints*>& allPoints)
+{
+	// empty point clouds can lack labels, so they are left out
+	std::vector<const PM::DataPoints*> points;
+	for(const auto& otherPoints: allPoints)
+	{
+		if(otherPoints->getNbPoints() > 0)
+		{
+			points.push_back(otherPoints);
+		}
+	}
+	if(points.empty())
+	{
+		return allPoints.empty() ? PM::DataPoints() : *allPoints.front();
+	}
+
+	// like with DataPoints::concatenate, only the descriptors and times present in all the point clouds are kept
+	const PM::DataPoints& firstPoints = *points.front();
+	PM::DataPoints::Labels descriptorLabels;
+	for(const auto& descriptorLabel: firstPoints.descriptorLabels)
+	{
+		bool isDescriptorCommon = true;
+		for(const auto& otherPoints: points)
+		{
+			isDescriptorCommon = isDescriptorCommon && otherPoints->descriptorExists(descriptorLabel.text, descriptorLabel.span);
+		}
+		if(isDescriptorCommon)
+		{
+			descriptorLabels.push_back(descriptorLabel);
+		}
+	}
+	bool areTimesCommon = true;
+	int nbPoints = 0;
+	for(const auto& otherPoints: points)
+	{
+		areTimesCommon = areTimesCommon && otherPoints->timeLabels == firstPoints.timeLabels;
+		nbPoints += otherPoints->getNbPoints();
+	}
+
+	PM::DataPoints mergedPoints(firstPoints.featureLabels, descriptorLabels, areTimesCommon ? firstPoints.timeLabels : PM::DataPoints::Labels(), nbPoints);
+	int offset = 0;
+	for(const auto& otherPoints: points)
+	{
+		const int nbOtherPoints = otherPoints->getNbPoints();
+		mergedPoints.features.middleCols(offset, nbOtherPoints) = otherPoints->features;
+		if(otherPoints->descriptorLabels == descriptorLabels)
+		{
+			mergedPoints.descriptors.middleCols(offset, nbOtherPoints) = otherPoints->descriptors;
+		}
+		else
+		{
+			for(const auto& descriptorLabel: descriptorLabels)
+			{
+				mergedPoints.getDescriptorViewByName(descriptorLabel.text).middleCols(offset, nbOtherPoints) =
+						otherPoints->getDescriptorViewByName(descriptorLabel.text);
+			}
+		}
+		if(areTimesCommon)
+		{
+			mergedPoints.times.middleCols(offset, nbOtherPoints) = otherPoints->times;
+		}
+		offset += nbOtherPoints;
+	}
+	return mergedPoints;
+}
+
+norlab_icp_mapper::DataPointsMerger::PM::DataPoints norlab_icp_mapper::DataPointsMerger::merge(const PM::DataPoints& points, const PM::DataPoints& otherPoints)
+{
+	return merge(std::vector<const PM::DataPoints*>{&points, &otherPoints});
+}
@@ -0,0 +1,20 @@
+#ifndef DATA_POINTS_MERGER_H
+#define DATA_POINTS_MERGER_H
+
+#include <pointmatcher/PointMatcher.h>
+
+namespace norlab_icp_mapper
+{
+	// Concatenation of many point clouds with a single allocation, each point cloud being copied block by block.
+	class DataPointsMerger
+	{
+	private:
+		typedef PointMatcher<float> PM;
+
+	public:
+		static PM::DataPoints merge(const std::vector<const PM::DataPoints*>& allPoints);
+		static PM::DataPoints merge(const PM::DataPoints& points, const PM::DataPoints& otherPoints);
+	};
+}
+
+#endif
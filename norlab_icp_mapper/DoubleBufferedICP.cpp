@@ -0,0 +1,114 @@
+#include "DoubleBufferedICP.h"
+#include <sstream>
+
+norlab_icp_mapper::DoubleBufferedICP::DoubleBufferedICP(Profiler& profiler):
+		frontBufferId(0),
+		profiler(profiler)
+{
+}
+
+void norlab_icp_mapper::DoubleBufferedICP::loadFromYaml(std::istream& in)
+{
+	std::string config((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	for(auto& buffer: buffers)
+	{
+		std::istringstream configStream(config);
+		buffer.loadFromYaml(configStream);
+	}
+}
+
+void norlab_icp_mapper::DoubleBufferedICP::setDefault()
+{
+	for(auto& buffer: buffers)
+	{
+		buffer.setDefault();
+	}
+}
+
+void norlab_icp_mapper::DoubleBufferedICP::useCellMatcher(const float& cellSize)
+{
+	// both buffers share their trees, so that blocks are indexed once for both of them
+	cellTreeStore = std::make_shared<CellTreeStore>();
+	for(auto& buffer: buffers)
+	{
+		if(buffer.matcher->className != "KDTreeMatcher")
+		{
+			throw std::runtime_error("incremental reference is set to true, but the ICP matcher is not a KDTreeMatcher.");
+		}
+		int knn = std::stoi(buffer.matcher->getParamValueString("knn"));
+		float epsilon = std::stof(buffer.matcher->getParamValueString("epsilon"));
+		float maxDist = std::stof(buffer.matcher->getParamValueString("maxDist"));
+		buffer.matcher = std::make_shared<CellMatcher>(knn, epsilon, maxDist, cellSize, cellTreeStore);
+	}
+}
+
+norlab_icp_mapper::DoubleBufferedICP::PM::TransformationParameters norlab_icp_mapper::DoubleBufferedICP::compute(const PM::DataPoints& input,
+																													float& overlap)
+{
+	// the buffers can be swapped between reading the front buffer id and locking it, in which case the locked buffer can be the one a new map
+	// is being set in, so the front buffer is looked up again instead of waiting for that map; once the front buffer is locked, its map is set
+	// again only after the registration is over
+	int bufferId;
+	std::unique_lock<std::mutex> bufferLockGuard;
+	{
+		Profiler::Span lockWaitSpan(profiler, Profiler::ICP_BUFFER_LOCK_WAIT);
+		while(true)
+		{
+			bufferId = frontBufferId.load();
+			bufferLockGuard = std::unique_lock<std::mutex>(bufferLocks[bufferId], std::try_to_lock);
+			if(!bufferLockGuard.owns_lock())
+			{
+				if(bufferId != frontBufferId.load())
+				{
+					continue;
+				}
+				// the front buffer is used by another registration
+				bufferLockGuard.lock();
+			}
+			if(bufferId == frontBufferId.load())
+			{
+				break;
+			}
+			bufferLockGuard.unlock();
+		}
+	}
+	PM::TransformationParameters correction = buffers[bufferId](input);
+	overlap = buffers[bufferId].errorMinimizer->getOverlap();
+	return correction;
+}
+
+void norlab_icp_mapper::DoubleBufferedICP::setMap(const PM::DataPoints& map)
+{
+	setMap(map, std::vector<ReferenceBlock>());
+}
+
+void norlab_icp_mapper::DoubleBufferedICP::setMap(const PM::DataPoints& map, const std::vector<ReferenceBlock>& blocks)
+{
+	std::lock_guard<std::mutex> setMapLockGuard(setMapLock);
+	int backBufferId = 1 - frontBufferId.load();
+	{
+		Profiler::Span lockWaitSpan(profiler, Profiler::ICP_BUFFER_LOCK_WAIT);
+		bufferLocks[backBufferId].lock();
+	}
+	std::shared_ptr<CellMatcher> cellMatcher = std::dynamic_pointer_cast<CellMatcher>(buffers[backBufferId].matcher);
+	if(cellMatcher && map.getNbPoints() > 0)
+	{
+		// the ICP centers the map on its mean before giving it to the matcher
+		const int euclideanDim = map.getEuclideanDim();
+		cellMatcher->setReferenceLayout(map.features.topRows(euclideanDim).rowwise().sum() / map.getNbPoints(), blocks);
+	}
+	buffers[backBufferId].setMap(map);
+	bufferLocks[backBufferId].unlock();
+	frontBufferId.store(backBufferId);
+}
+
+norlab_icp_mapper::CellMatcherStats norlab_icp_mapper::DoubleBufferedICP::getCellMatcherStats()
+{
+	CellMatcherStats stats = {0, 0};
+	if(cellTreeStore)
+	{
+		stats.nbReusedTrees = cellTreeStore->getNbReusedTrees();
+		stats.nbBuiltTrees = cellTreeStore->getNbBuiltTrees();
+	}
+	return stats;
+}
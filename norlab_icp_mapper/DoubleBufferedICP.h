@@ -0,0 +1,45 @@
+#ifndef DOUBLE_BUFFERED_ICP_H
+#define DOUBLE_BUFFERED_ICP_H
+
+#include <pointmatcher/PointMatcher.h>
+#include <mutex>
+#include <atomic>
+#include "Profiler.h"
+#include "CellMatcher.h"
+
+namespace norlab_icp_mapper
+{
+	typedef struct CellMatcherStats
+	{
+		std::uint64_t nbReusedTrees;
+		std::uint64_t nbBuiltTrees;
+	} CellMatcherStats;
+
+	// Pair of identically configured ICP sequences. New maps are set in the back buffer, which is then swapped with the front buffer,
+	// so that registrations never wait for a map to be set.
+	class DoubleBufferedICP
+	{
+	private:
+		typedef PointMatcher<float> PM;
+
+		PM::ICPSequence buffers[2];
+		std::mutex bufferLocks[2];
+		std::atomic_int frontBufferId;
+		std::mutex setMapLock;
+		std::shared_ptr<CellTreeStore> cellTreeStore;
+		Profiler& profiler;
+
+	public:
+		DoubleBufferedICP(Profiler& profiler);
+		void loadFromYaml(std::istream& in);
+		void setDefault();
+		void useCellMatcher(const float& cellSize);
+		PM::TransformationParameters compute(const PM::DataPoints& input, float& overlap);
+		void setMap(const PM::DataPoints& map);
+		// set a map made of blocks of points, so that a cell matcher only indexes again the blocks whose version changed
+		void setMap(const PM::DataPoints& map, const std::vector<ReferenceBlock>& blocks);
+		CellMatcherStats getCellMatcherStats();
+	};
+}
+
+#endif
@@ -1,37 +1,240 @@
 #include "HardDriveCellManager.h"
+#include "CellSerializer.h"
 #include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <cstdio>
+
+norlab_icp_mapper::HardDriveCellManager::HardDriveCellManager(const std::string& cellFolder, ThreadPool& threadPool):
+		cellFolder(cellFolder),
+		isPersistent(false),
+		cellSize(0),
+		euclideanDim(0),
+		nbSessions(0),
+		threadPool(threadPool)
+{
+}
+
+norlab_icp_mapper::HardDriveCellManager::HardDriveCellManager(const std::string& cellFolder, const float& cellSize, const int& euclideanDim,
+															  ThreadPool& threadPool):
+		cellFolder(cellFolder),
+		isPersistent(true),
+		cellSize(cellSize),
+		euclideanDim(euclideanDim),
+		nbSessions(0),
+		threadPool(threadPool)
+{
+	std::ifstream manifest(cellFolder + "/" + MANIFEST_FILE_NAME);
+	if(manifest.good())
+	{
+		manifest.close();
+		readManifest();
+	}
+
+	// the session is recorded right away, so that a session which does not shut down cleanly is still counted
+	nbSessions++;
+	writeManifest();
+}
 
 norlab_icp_mapper::HardDriveCellManager::~HardDriveCellManager()
 {
-	clearAllCells();
+	if(!isPersistent)
+	{
+		clearAllCells();
+	}
 }
 
-std::vector<std::string> norlab_icp_mapper::HardDriveCellManager::getAllCellIds() const
+std::vector<norlab_icp_mapper::CellId> norlab_icp_mapper::HardDriveCellManager::getAllCellIds() const
 {
-	return std::vector<std::string>(cellIds.begin(), cellIds.end());
+	return std::vector<CellId>(cellIds.begin(), cellIds.end());
 }
 
-void norlab_icp_mapper::HardDriveCellManager::saveCell(const std::string& cellId, const PM::DataPoints& cell)
+void norlab_icp_mapper::HardDriveCellManager::saveCell(const CellId& cellId, const PM::DataPoints& cell)
 {
-	cell.save(CELL_FOLDER + CELL_FILE_NAME_PREFIX + cellId + CELL_FILE_NAME_SUFFIX);
-	cellIds.insert(cellId);
+	writeCell(cellId, cell);
+	if(cellIds.insert(cellId).second && isPersistent)
+	{
+		appendToManifest({cellId});
+	}
 }
 
-norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::HardDriveCellManager::retrieveCell(const std::string& cellId) const
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::HardDriveCellManager::retrieveCell(const CellId& cellId) const
 {
 	PM::DataPoints cell;
 	if(cellIds.find(cellId) != cellIds.end())
 	{
-		cell = PM::DataPoints::load(CELL_FOLDER + CELL_FILE_NAME_PREFIX + cellId + CELL_FILE_NAME_SUFFIX);
+		std::ifstream ifs(getCellFileName(cellId), std::ios::binary);
+		cell = CellSerializer::read(ifs);
 	}
 	return cell;
 }
 
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::HardDriveCellManager::retrieveCells(const std::vector<CellId>& cellIds) const
+{
+	// reading cells does not modify the cell manager, so they are read and decoded concurrently
+	std::vector<PM::DataPoints> cells(cellIds.size());
+	threadPool.parallelFor(cellIds.size(), [&](const int& i)
+	{
+		cells[i] = retrieveCell(cellIds[i]);
+	});
+	return cells;
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::HardDriveCellManager::takeCells(const std::vector<CellId>& cellIds)
+{
+	return retrieveCells(cellIds);
+}
+
+void norlab_icp_mapper::HardDriveCellManager::saveCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>&& cells)
+{
+	// every cell has its own file, so they are encoded and written concurrently
+	threadPool.parallelFor(cellIds.size(), [&](const int& i)
+	{
+		writeCell(cellIds[i], cells[i]);
+	});
+
+	std::vector<CellId> newCellIds;
+	for(const auto& cellId: cellIds)
+	{
+		if(this->cellIds.insert(cellId).second)
+		{
+			newCellIds.push_back(cellId);
+		}
+	}
+	if(isPersistent && !newCellIds.empty())
+	{
+		appendToManifest(newCellIds);
+	}
+}
+
 void norlab_icp_mapper::HardDriveCellManager::clearAllCells()
 {
 	for(const auto& cellId: cellIds)
 	{
-		std::remove((CELL_FOLDER + CELL_FILE_NAME_PREFIX + cellId + CELL_FILE_NAME_SUFFIX).c_str());
+		std::remove(getCellFileName(cellId).c_str());
 	}
 	cellIds.clear();
+
+	if(isPersistent)
+	{
+		writeManifest();
+	}
+}
+
+void norlab_icp_mapper::HardDriveCellManager::writeCell(const CellId& cellId, const PM::DataPoints& cell) const
+{
+	if(!isPersistent)
+	{
+		std::ofstream ofs(getCellFileName(cellId), std::ios::binary);
+		CellSerializer::write(ofs, cell);
+		return;
+	}
+
+	// cells of a persistent map are replaced atomically, so that an interrupted write leaves the previous version of the cell
+	const std::string fileName = getCellFileName(cellId);
+	const std::string temporaryFileName = fileName + ".tmp";
+	{
+		std::ofstream ofs(temporaryFileName, std::ios::binary);
+		CellSerializer::write(ofs, cell);
+		if(!ofs)
+		{
+			throw std::runtime_error("unable to write " + temporaryFileName + ".");
+		}
+	}
+	if(std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+	{
+		throw std::runtime_error("unable to write " + fileName + ".");
+	}
+}
+
+void norlab_icp_mapper::HardDriveCellManager::readManifest()
+{
+	const std::string fileName = cellFolder + "/" + MANIFEST_FILE_NAME;
+	std::ifstream ifs(fileName);
+	std::string format;
+	int version;
+	ifs >> format >> version;
+	if(!ifs || format != MANIFEST_FORMAT || version != MANIFEST_VERSION)
+	{
+		throw std::runtime_error("invalid map manifest: " + fileName + ", expected " + MANIFEST_FORMAT + " version " + std::to_string(MANIFEST_VERSION) + ".");
+	}
+
+	std::string key;
+	float manifestCellSize;
+	int manifestEuclideanDim;
+	ifs >> key >> manifestCellSize >> key >> manifestEuclideanDim >> key >> nbSessions >> key;
+	if(!ifs || key != "cells")
+	{
+		throw std::runtime_error("invalid map manifest: " + fileName + ".");
+	}
+	if(manifestCellSize != cellSize || manifestEuclideanDim != euclideanDim)
+	{
+		throw std::runtime_error("incompatible map in " + cellFolder + ": cell size " + std::to_string(manifestCellSize) + " in " +
+								 std::to_string(manifestEuclideanDim) + "D, expected " + std::to_string(cellSize) + " in " + std::to_string(euclideanDim) +
+								 "D.");
+	}
+
+	// a last line without end of line was being appended when a session was interrupted, so the cell it lists may be incomplete
+	std::string line;
+	std::getline(ifs, line);
+	while(std::getline(ifs, line) && !ifs.eof())
+	{
+		std::istringstream lineStream(line);
+		int row, column, aisle;
+		if(!(lineStream >> row >> column >> aisle))
+		{
+			throw std::runtime_error("invalid map manifest: " + fileName + ", unable to parse cell " + line + ".");
+		}
+		cellIds.insert(toCellId(row, column, aisle));
+	}
+}
+
+void norlab_icp_mapper::HardDriveCellManager::writeManifest() const
+{
+	// the manifest is replaced atomically, so that it never lists cells which were not completely written
+	const std::string fileName = cellFolder + "/" + MANIFEST_FILE_NAME;
+	const std::string temporaryFileName = fileName + ".tmp";
+	{
+		std::ofstream ofs(temporaryFileName);
+		ofs << std::setprecision(std::numeric_limits<float>::max_digits10);
+		ofs << MANIFEST_FORMAT << " " << MANIFEST_VERSION << std::endl;
+		ofs << "cellSize " << cellSize << std::endl;
+		ofs << "euclideanDim " << euclideanDim << std::endl;
+		ofs << "nbSessions " << nbSessions << std::endl;
+		ofs << "cells" << std::endl;
+		for(const auto& cellId: cellIds)
+		{
+			ofs << toRow(cellId) << " " << toColumn(cellId) << " " << toAisle(cellId) << std::endl;
+		}
+		if(!ofs)
+		{
+			throw std::runtime_error("unable to write " + temporaryFileName + ".");
+		}
+	}
+	if(std::rename(temporaryFileName.c_str(), fileName.c_str()) != 0)
+	{
+		throw std::runtime_error("unable to write " + fileName + ".");
+	}
+}
+
+void norlab_icp_mapper::HardDriveCellManager::appendToManifest(const std::vector<CellId>& newCellIds) const
+{
+	// cells are listed once their file is in place
+	const std::string fileName = cellFolder + "/" + MANIFEST_FILE_NAME;
+	std::ofstream ofs(fileName, std::ios::app);
+	for(const auto& cellId: newCellIds)
+	{
+		ofs << toRow(cellId) << " " << toColumn(cellId) << " " << toAisle(cellId) << std::endl;
+	}
+	if(!ofs)
+	{
+		throw std::runtime_error("unable to write " + fileName + ".");
+	}
+}
+
+std::string norlab_icp_mapper::HardDriveCellManager::getCellFileName(const CellId& cellId) const
+{
+	return cellFolder + "/" + CELL_FILE_NAME_PREFIX + std::to_string(toRow(cellId)) + "_" + std::to_string(toColumn(cellId)) + "_" + std::to_string(toAisle(cellId)) +
+		   CELL_FILE_NAME_SUFFIX;
 }
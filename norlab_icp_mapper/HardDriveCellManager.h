@@ -2,24 +2,50 @@
 #define HARD_DRIVE_CELL_MANAGER_H
 
 #include "CellManager.h"
+#include "ThreadPool.h"
 #include <unordered_set>
 
 namespace norlab_icp_mapper
 {
+	// Cell manager storing every cell in its own file. Cells are temporary by default, unless the folder is opened as a persistent map, in which
+	// case a manifest lists the stored cells so that the map can be reopened by later sessions without reading the cells. New cells are appended
+	// to the manifest as they are saved, and it is compacted when the map is opened.
 	class HardDriveCellManager : public CellManager
 	{
 	private:
-		const std::string CELL_FOLDER = "/tmp/";
 		const std::string CELL_FILE_NAME_PREFIX = "cell_";
-		const std::string CELL_FILE_NAME_SUFFIX = ".vtk";
-		std::unordered_set<std::string> cellIds;
+		const std::string CELL_FILE_NAME_SUFFIX = ".cell";
+		const std::string MANIFEST_FILE_NAME = "manifest.txt";
+		const std::string MANIFEST_FORMAT = "norlab_icp_mapper_map";
+		const int MANIFEST_VERSION = 1;
+		std::string cellFolder;
+		std::unordered_set<CellId, CellIdHash> cellIds;
+		bool isPersistent;
+		float cellSize;
+		int euclideanDim;
+		int nbSessions;
+		ThreadPool& threadPool;
+
+		std::string getCellFileName(const CellId& cellId) const;
+		void writeCell(const CellId& cellId, const PM::DataPoints& cell) const;
+		void readManifest();
+		void writeManifest() const;
+		void appendToManifest(const std::vector<CellId>& newCellIds) const;
 
 	public:
+		using CellManager::saveCell;
+
+		HardDriveCellManager(const std::string& cellFolder, ThreadPool& threadPool);
+		// open or create the persistent map stored in cellFolder, whose cell size and dimension have to match the given ones
+		HardDriveCellManager(const std::string& cellFolder, const float& cellSize, const int& euclideanDim, ThreadPool& threadPool);
 		~HardDriveCellManager() override;
-		std::vector<std::string> getAllCellIds() const override;
-		void saveCell(const std::string& cellId, const PM::DataPoints& cell) override;
-		PM::DataPoints retrieveCell(const std::string& cellId) const override;
+		std::vector<CellId> getAllCellIds() const override;
+		void saveCell(const CellId& cellId, const PM::DataPoints& cell) override;
+		PM::DataPoints retrieveCell(const CellId& cellId) const override;
 		void clearAllCells() override;
+		std::vector<PM::DataPoints> retrieveCells(const std::vector<CellId>& cellIds) const override;
+		std::vector<PM::DataPoints> takeCells(const std::vector<CellId>& cellIds) override;
+		void saveCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>&& cells) override;
 	};
 }
 
@@ -1,15 +1,29 @@
 #include "Map.h"
 #include "RAMCellManager.h"
 #include "HardDriveCellManager.h"
+#include "MappedSegmentCellManager.h"
+#include "CachedCellManager.h"
+#include "PrefetchingCellManager.h"
+#include "RangeImage.h"
+#include "DataPointsMerger.h"
+#include "CellSerializer.h"
 #include <nabo/nabo.h>
 #include <unordered_map>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <sys/stat.h>
 
 norlab_icp_mapper::Map::Map(const float& minDistNewPoint, const float& sensorMaxRange, const float& priorDynamic, const float& thresholdDynamic,
 							const float& beamHalfAngle, const float& epsilonA, const float& epsilonD, const float& alpha, const float& beta, const bool& is3D,
-							const bool& isOnline, const bool& computeProbDynamic, const bool& saveCellsOnHardDrive, PM::ICPSequence& icp,
-							std::mutex& icpMapLock):
-		minDistNewPoint(minDistNewPoint),
+							const bool& isOnline, const bool& computeProbDynamic, const std::string& beamSearchMethod, const bool& saveCellsOnHardDrive,
+							const std::string& hardDriveCellStore, const std::string& hardDriveCellFolder, const float& hardDriveCellCacheSize,
+							const float& submapLength, const float& cellSize, const int& bufferSize, const float& postFilterMargin, Profiler& profiler,
+							ThreadPool& threadPool, DoubleBufferedICP& icp):
 		sensorMaxRange(sensorMaxRange),
+		minDistNewPoint(minDistNewPoint),
 		priorDynamic(priorDynamic),
 		thresholdDynamic(thresholdDynamic),
 		beamHalfAngle(beamHalfAngle),
@@ -20,176 +34,289 @@ norlab_icp_mapper::Map::Map(const float& minDistNewPoint, const float& sensorMax
 		is3D(is3D),
 		isOnline(isOnline),
 		computeProbDynamic(computeProbDynamic),
+		beamSearchMethod(beamSearchMethod),
+		submapLength(submapLength),
+		cellSize(cellSize),
+		bufferSize(bufferSize),
+		postFilterMargin(postFilterMargin),
+		isMapPersistent(saveCellsOnHardDrive && hardDriveCellStore == "persistent"),
 		icp(icp),
-		icpMapLock(icpMapLock),
+		profiler(profiler),
+		threadPool(threadPool),
+		localPointCloud(std::make_shared<const PM::DataPoints>()),
+		localPointCloudVersion(0),
+		oldestLocalPointCloudDeltaVersion(0),
+		localPointCloudSize(0),
+		nbLocalPointCloudCells(0),
+		nbLoadedBytes(0),
+		nbUnloadedBytes(0),
+		cellCache(nullptr),
+		neighborFrozenWindow{0, 0, 0, 0, 0, 0},
 		transformation(PM::get().TransformationRegistrar.create("RigidTransformation")),
+		loadedWindow{0, 0, 0, 0, 0, 0},
 		newLocalPointCloudAvailable(false),
 		localPointCloudEmpty(true),
 		firstPoseUpdate(true),
 		updateThreadLooping(true)
 {
+	if(minDistNewPoint < 0)
+	{
+		throw std::runtime_error("invalid minimum distance of new points: " + std::to_string(minDistNewPoint) + ", expected a non-negative value.");
+	}
+	if(computeProbDynamic && beamHalfAngle <= 0)
+	{
+		// the beam half angle sets the pixel size of the range image and normalizes the angular distances
+		throw std::runtime_error("invalid beam half angle: " + std::to_string(beamHalfAngle) + ", expected a positive value.");
+	}
+	if(cellSize <= 0)
+	{
+		throw std::runtime_error("invalid cell size: " + std::to_string(cellSize) + ", expected a positive value.");
+	}
+	if(bufferSize < 0)
+	{
+		throw std::runtime_error("invalid buffer size: " + std::to_string(bufferSize) + ", expected a non-negative value.");
+	}
+	if(postFilterMargin < 0 || postFilterMargin > cellSize)
+	{
+		// only the points of the adjacent cells are filtered along with a cell
+		throw std::runtime_error("invalid post filter margin: " + std::to_string(postFilterMargin) + ", expected a value between 0 and the cell size.");
+	}
+
+	if(beamSearchMethod != "kdtree" && beamSearchMethod != "rangeImage")
+	{
+		throw std::runtime_error("invalid beam search method: " + beamSearchMethod + ", expected kdtree or rangeImage.");
+	}
+
 	if(saveCellsOnHardDrive)
 	{
-		cellManager = std::unique_ptr<CellManager>(new HardDriveCellManager());
+		if(hardDriveCellStore == "files")
+		{
+			cellManager = std::unique_ptr<CellManager>(new HardDriveCellManager(hardDriveCellFolder, threadPool));
+		}
+		else if(hardDriveCellStore == "segments")
+		{
+			cellManager = std::unique_ptr<CellManager>(new MappedSegmentCellManager(hardDriveCellFolder, threadPool));
+		}
+		else if(hardDriveCellStore == "persistent")
+		{
+			if(submapLength > 0)
+			{
+				throw std::runtime_error("a persistent map cannot be used with submaps, since frozen cells are not saved with the map.");
+			}
+			cellManager = std::unique_ptr<CellManager>(new HardDriveCellManager(hardDriveCellFolder, cellSize, is3D ? 3 : 2, threadPool));
+		}
+		else
+		{
+			throw std::runtime_error("invalid hard drive cell store: " + hardDriveCellStore + ", expected files, segments or persistent.");
+		}
+
+		if(hardDriveCellCacheSize > 0)
+		{
+			cellCache = new CachedCellManager(std::move(cellManager), hardDriveCellCacheSize * 1024 * 1024);
+			cellManager = std::unique_ptr<CellManager>(cellCache);
+		}
 	}
 	else
 	{
 		cellManager = std::unique_ptr<CellManager>(new RAMCellManager());
 	}
 
+	// frozen cells are kept in a store of the same kind as the unloaded cells, only the ones around the robot being read back
+	if(submapLength > 0)
+	{
+		if(saveCellsOnHardDrive)
+		{
+			frozenCellFolder = hardDriveCellFolder + "/" + FROZEN_CELL_FOLDER_NAME;
+			if(mkdir(frozenCellFolder.c_str(), 0755) != 0 && errno != EEXIST)
+			{
+				throw std::runtime_error("unable to create " + frozenCellFolder + ".");
+			}
+			if(hardDriveCellStore == "files")
+			{
+				frozenCellManager = std::unique_ptr<CellManager>(new HardDriveCellManager(frozenCellFolder, threadPool));
+			}
+			else
+			{
+				frozenCellManager = std::unique_ptr<CellManager>(new MappedSegmentCellManager(frozenCellFolder, threadPool));
+			}
+		}
+		else
+		{
+			frozenCellManager = std::unique_ptr<CellManager>(new RAMCellManager());
+		}
+	}
+
 	if(isOnline)
 	{
+		// cells kept in RAM are already in memory, so only the hard drive stores are prefetched
+		if(saveCellsOnHardDrive)
+		{
+			cellManager = std::unique_ptr<CellManager>(new PrefetchingCellManager(std::move(cellManager)));
+		}
 		updateThread = std::thread(&Map::updateThreadFunction, this);
 	}
 }
 
 void norlab_icp_mapper::Map::updateThreadFunction()
 {
+	std::unique_lock<std::mutex> updateListGuard(updateListLock);
 	while(updateThreadLooping.load())
 	{
-		updateListLock.lock();
-		bool isUpdateListEmpty = updateList.empty();
-		updateListLock.unlock();
+		updateListCondition.wait(updateListGuard, [this]
+		{
+			return !updateList.empty() || !updateThreadLooping.load();
+		});
 
-		if(!isUpdateListEmpty)
+		while(!updateList.empty() && updateThreadLooping.load())
 		{
-			updateListLock.lock();
 			Update update = updateList.front();
 			updateList.pop_front();
-			updateListLock.unlock();
+			updateListGuard.unlock();
 
 			applyUpdate(update);
-		}
-		else
-		{
-			std::this_thread::sleep_for(std::chrono::duration<float>(0.01));
+
+			updateListGuard.lock();
 		}
 	}
 }
 
 void norlab_icp_mapper::Map::applyUpdate(const Update& update)
 {
-	if(update.load)
-	{
-		loadCells(update.startRow, update.endRow, update.startColumn, update.endColumn, update.startAisle, update.endAisle);
-	}
-	else
+	switch(update.type)
 	{
-		unloadCells(update.startRow, update.endRow, update.startColumn, update.endColumn, update.startAisle, update.endAisle);
+		case LOAD:
+			loadCells(update.startRow, update.endRow, update.startColumn, update.endColumn, update.startAisle, update.endAisle);
+			break;
+		case UNLOAD:
+			unloadCells(update.startRow, update.endRow, update.startColumn, update.endColumn, update.startAisle, update.endAisle);
+			break;
+		case FREEZE:
+			freezeActiveSubmap();
+			break;
+		case GATHER_FROZEN_CELLS:
+			gatherNeighborFrozenCells(GridWindow{update.startRow, update.endRow, update.startColumn, update.endColumn, update.startAisle, update.endAisle});
+			break;
 	}
 }
 
 void norlab_icp_mapper::Map::loadCells(int startRow, int endRow, int startColumn, int endColumn, int startAisle, int endAisle)
 {
+	Profiler::Span loadCellsSpan(profiler, Profiler::LOAD_CELLS);
+
 	if(!is3D)
 	{
 		startAisle = 0;
 		endAisle = 0;
 	}
 
-	PM::DataPoints newChunk;
+	// cells are transferred between the local map and the cell manager without being visited in between
+	std::lock_guard<std::mutex> cellTransferGuard(cellTransferLock);
+
+	std::vector<CellId> cellIds;
 	for(int i = startRow; i <= endRow; i++)
 	{
 		for(int j = startColumn; j <= endColumn; j++)
 		{
 			for(int k = startAisle; k <= endAisle; k++)
 			{
-				cellManagerLock.lock();
-				PM::DataPoints cell = cellManager->retrieveCell(std::to_string(i) + "_" + std::to_string(j) + "_" + std::to_string(k));
-				cellManagerLock.unlock();
-
-				if(cell.getNbPoints() > 0)
-				{
-					if(newChunk.getNbPoints() == 0)
-					{
-						newChunk = cell;
-					}
-					else
-					{
-						newChunk.concatenate(cell);
-					}
-				}
+				cellIds.push_back(toCellId(i, j, k));
 			}
 		}
 	}
 
-	localPointCloudLock.lock();
-	if(newChunk.getNbPoints() > 0)
+	std::vector<PM::DataPoints> cells;
 	{
-		localPointCloud.concatenate(newChunk);
-
-		icpMapLock.lock();
-		icp.setMap(localPointCloud);
-		icpMapLock.unlock();
-
-		localPointCloudEmpty.store(false);
-		newLocalPointCloudAvailable = true;
+		Profiler::Span cellRetrievalSpan(profiler, Profiler::CELL_RETRIEVAL);
+		cellManagerLock.lock();
+		cells = cellManager->takeCells(cellIds);
+		cellManagerLock.unlock();
 	}
-	for(int i = startRow; i <= endRow; i++)
+
+	std::vector<CellId> newCellIds;
+	std::vector<PM::DataPoints> newCells;
+	for(int i = 0; i < cells.size(); i++)
 	{
-		for(int j = startColumn; j <= endColumn; j++)
+		if(cells[i].getNbPoints() > 0)
 		{
-			for(int k = startAisle; k <= endAisle; k++)
-			{
-				loadedCellIds.insert(std::to_string(i) + "_" + std::to_string(j) + "_" + std::to_string(k));
-			}
+			nbLoadedBytes.fetch_add(CellSerializer::getSerializedSize(cells[i]), std::memory_order_relaxed);
+			newCellIds.push_back(cellIds[i]);
+			newCells.push_back(std::move(cells[i]));
 		}
 	}
-	localPointCloudLock.unlock();
-}
-
-float norlab_icp_mapper::Map::toInferiorWorldCoordinate(const int& gridCoordinate) const
-{
-	return gridCoordinate * CELL_SIZE;
-}
 
-float norlab_icp_mapper::Map::toSuperiorWorldCoordinate(const int& gridCoordinate) const
-{
-	return (gridCoordinate + 1) * CELL_SIZE;
+	lockLocalPointCloud();
+	if(!newCells.empty())
+	{
+		localPointCloudVersion++;
+		addToLocalPointCloudCells(newCellIds, newCells);
+		rebuildLocalPointCloud();
+	}
+	loadedCellIds.insert(cellIds.begin(), cellIds.end());
+	localPointCloudLock.unlock();
 }
 
 void norlab_icp_mapper::Map::unloadCells(int startRow, int endRow, int startColumn, int endColumn, int startAisle, int endAisle)
 {
+	Profiler::Span unloadCellsSpan(profiler, Profiler::UNLOAD_CELLS);
+
 	if(!is3D)
 	{
 		startAisle = 0;
 		endAisle = 0;
 	}
 
-	float startX = toInferiorWorldCoordinate(startRow);
-	float endX = toSuperiorWorldCoordinate(endRow);
-	float startY = toInferiorWorldCoordinate(startColumn);
-	float endY = toSuperiorWorldCoordinate(endColumn);
-	float startZ = toInferiorWorldCoordinate(startAisle);
-	float endZ = toSuperiorWorldCoordinate(endAisle);
-
-	int localPointCloudNbPoints = 0;
-	int oldChunkNbPoints = 0;
+	// cells are transferred between the local map and the cell manager without being visited in between
+	std::lock_guard<std::mutex> cellTransferGuard(cellTransferLock);
 
-	localPointCloudLock.lock();
+	lockLocalPointCloud();
+	localPointCloudVersion++;
 
-	PM::DataPoints oldChunk = localPointCloud.createSimilarEmpty();
-	for(int i = 0; i < localPointCloud.features.cols(); i++)
+	std::vector<CellId> oldCellIds;
+	std::vector<PM::DataPoints> oldCells;
+	for(auto cell = localPointCloudCells.begin(); cell != localPointCloudCells.end();)
 	{
-		if(localPointCloud.features(0, i) >= startX && localPointCloud.features(0, i) < endX && localPointCloud.features(1, i) >= startY &&
-		   localPointCloud.features(1, i) < endY && localPointCloud.features(2, i) >= startZ && localPointCloud.features(2, i) < endZ)
+		const int row = toRow(cell->first);
+		const int column = toColumn(cell->first);
+		const int aisle = toAisle(cell->first);
+		if(row >= startRow && row <= endRow && column >= startColumn && column <= endColumn && aisle >= startAisle && aisle <= endAisle)
 		{
-			oldChunk.setColFrom(oldChunkNbPoints, localPointCloud, i);
-			oldChunkNbPoints++;
+			oldCellIds.push_back(cell->first);
+			oldCells.push_back(std::move(cell->second.points));
+			recordLocalPointCloudCellRemoval(cell->first);
+			cell = localPointCloudCells.erase(cell);
 		}
 		else
 		{
-			localPointCloud.setColFrom(localPointCloudNbPoints, localPointCloud, i);
-			localPointCloudNbPoints++;
+			++cell;
 		}
 	}
-	localPointCloud.conservativeResize(localPointCloudNbPoints);
 
-	icpMapLock.lock();
-	icp.setMap(localPointCloud);
-	icpMapLock.unlock();
+	if(!oldCells.empty())
+	{
+		rebuildLocalPointCloud();
+	}
 
-	if(!loadedCellIds.empty())
+	// the range can span the whole grid, in which case the loaded cells are visited instead of the range
+	const double nbRangeCells = (static_cast<double>(endRow) - startRow + 1) * (static_cast<double>(endColumn) - startColumn + 1) *
+								(static_cast<double>(endAisle) - startAisle + 1);
+	if(nbRangeCells > loadedCellIds.size())
+	{
+		for(auto cellId = loadedCellIds.begin(); cellId != loadedCellIds.end();)
+		{
+			const int row = toRow(*cellId);
+			const int column = toColumn(*cellId);
+			const int aisle = toAisle(*cellId);
+			if(row >= startRow && row <= endRow && column >= startColumn && column <= endColumn && aisle >= startAisle && aisle <= endAisle)
+			{
+				cellId = loadedCellIds.erase(cellId);
+			}
+			else
+			{
+				++cellId;
+			}
+		}
+	}
+	else
 	{
 		for(int i = startRow; i <= endRow; i++)
 		{
@@ -197,476 +324,1061 @@ void norlab_icp_mapper::Map::unloadCells(int startRow, int endRow, int startColu
 			{
 				for(int k = startAisle; k <= endAisle; k++)
 				{
-					loadedCellIds.erase(std::to_string(i) + "_" + std::to_string(j) + "_" + std::to_string(k));
+					loadedCellIds.erase(toCellId(i, j, k));
 				}
 			}
 		}
 	}
 
-	localPointCloudEmpty.store(localPointCloud.getNbPoints() == 0);
-	newLocalPointCloudAvailable = true;
-
 	localPointCloudLock.unlock();
 
-	oldChunk.conservativeResize(oldChunkNbPoints);
-
-	std::unordered_map<std::string, PM::DataPoints> cells;
-	std::unordered_map<std::string, int> cellPointCounts;
-	for(int i = 0; i < oldChunk.getNbPoints(); i++)
+	Profiler::Span cellSavingSpan(profiler, Profiler::CELL_SAVING);
+	for(int i = 0; i < oldCells.size(); i++)
 	{
-		int row = toGridCoordinate(oldChunk.features(0, i));
-		int column = toGridCoordinate(oldChunk.features(1, i));
-		int aisle = toGridCoordinate(oldChunk.features(2, i));
-		std::string cellId = std::to_string(row) + "_" + std::to_string(column) + "_" + std::to_string(aisle);
-
-		if(cells[cellId].getNbPoints() == 0)
-		{
-			cells[cellId] = oldChunk.createSimilarEmpty();
-		}
-
-		cells[cellId].setColFrom(cellPointCounts[cellId], oldChunk, i);
-		cellPointCounts[cellId]++;
-	}
-	for(auto& cell: cells)
-	{
-		cell.second.conservativeResize(cellPointCounts[cell.first]);
+		nbUnloadedBytes.fetch_add(CellSerializer::getSerializedSize(oldCells[i]), std::memory_order_relaxed);
 		cellManagerLock.lock();
-		cellManager->saveCell(cell.first, cell.second);
+		cellManager->saveCell(oldCellIds[i], std::move(oldCells[i]));
 		cellManagerLock.unlock();
 	}
 }
 
-int norlab_icp_mapper::Map::toGridCoordinate(const float& worldCoordinate) const
-{
-	return std::floor(worldCoordinate / CELL_SIZE);
-}
-
-norlab_icp_mapper::Map::~Map()
+void norlab_icp_mapper::Map::partitionIntoCells(const PM::DataPoints& points, std::vector<CellId>& cellIds, std::vector<PM::DataPoints>& cells) const
 {
-	if(isOnline)
+	// compute the grid coordinates of all the points in a single pass
+	const int nbPoints = points.getNbPoints();
+	Eigen::ArrayXXi gridCoordinates = Eigen::ArrayXXi::Zero(3, nbPoints);
+	if(is3D)
 	{
-		updateThreadLooping.store(false);
-		updateThread.join();
+		gridCoordinates = (points.features.topRows<3>().array() / cellSize).floor().cast<int>();
+	}
+	else
+	{
+		gridCoordinates.topRows<2>() = (points.features.topRows<2>().array() / cellSize).floor().cast<int>();
 	}
-}
 
-void norlab_icp_mapper::Map::updatePose(const PM::TransformationParameters& pose)
-{
-	int positionColumn = is3D ? 3 : 2;
-	if(firstPoseUpdate.load())
+	cellIds.clear();
+	std::vector<int> pointCells(nbPoints);
+	std::unordered_map<CellId, int, CellIdHash> cellIndices;
+	for(int i = 0; i < nbPoints; i++)
 	{
-		inferiorRowLastUpdateIndex = toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange);
-		superiorRowLastUpdateIndex = toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange);
-		inferiorColumnLastUpdateIndex = toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange);
-		superiorColumnLastUpdateIndex = toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange);
-		if(is3D)
+		// consecutive points are often in the same cell
+		CellId cellId = toCellId(gridCoordinates(0, i), gridCoordinates(1, i), gridCoordinates(2, i));
+		if(i > 0 && cellId == cellIds[pointCells[i - 1]])
 		{
-			inferiorAisleLastUpdateIndex = toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange);
-			superiorAisleLastUpdateIndex = toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange);
+			pointCells[i] = pointCells[i - 1];
+			continue;
 		}
 
-		cellManagerLock.lock();
-		cellManager->clearAllCells();
-		cellManagerLock.unlock();
-		localPointCloudLock.lock();
-		loadedCellIds.clear();
-		localPointCloudLock.unlock();
-
-		unloadCells(getMinGridCoordinate(), getMaxGridCoordinate(), getMinGridCoordinate(),
-					getMaxGridCoordinate(), getMinGridCoordinate(), getMaxGridCoordinate());
-		loadCells(inferiorRowLastUpdateIndex - BUFFER_SIZE, superiorRowLastUpdateIndex + BUFFER_SIZE, inferiorColumnLastUpdateIndex - BUFFER_SIZE,
-				  superiorColumnLastUpdateIndex + BUFFER_SIZE, inferiorAisleLastUpdateIndex - BUFFER_SIZE, superiorAisleLastUpdateIndex + BUFFER_SIZE);
+		auto cellIndex = cellIndices.emplace(cellId, cellIds.size());
+		if(cellIndex.second)
+		{
+			cellIds.push_back(cellId);
+		}
+		pointCells[i] = cellIndex.first->second;
+	}
 
-		firstPoseUpdate.store(false);
+	// counting sort of the point ids by cell
+	std::vector<int> cellStarts(cellIds.size() + 1, 0);
+	for(int i = 0; i < nbPoints; i++)
+	{
+		cellStarts[pointCells[i] + 1]++;
 	}
-	else
+	for(int i = 1; i < cellStarts.size(); i++)
+	{
+		cellStarts[i] += cellStarts[i - 1];
+	}
+	std::vector<int> sortedPointIds(nbPoints);
+	std::vector<int> cellEnds(cellStarts.begin(), cellStarts.end() - 1);
+	for(int i = 0; i < nbPoints; i++)
+	{
+		sortedPointIds[cellEnds[pointCells[i]]++] = i;
+	}
+
+	// cells are disjoint ranges of the sorted point ids, so they are gathered concurrently
+	cells.clear();
+	cells.resize(cellIds.size());
+	threadPool.parallelFor(cellIds.size(), [&](const int& i)
+	{
+		cells[i] = gatherPoints(points, sortedPointIds, cellStarts[i], cellStarts[i + 1]);
+	});
+}
+
+void norlab_icp_mapper::Map::addToLocalPointCloudCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>& cells)
+{
+	for(int i = 0; i < cellIds.size(); i++)
 	{
-		// manage cells in the back
-		if(std::abs(toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - inferiorRowLastUpdateIndex) >= 2)
+		auto cell = localPointCloudCells.find(cellIds[i]);
+		if(cell == localPointCloudCells.end())
 		{
-			// move back
-			if(toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) < inferiorRowLastUpdateIndex)
-			{
-				int nbRows = inferiorRowLastUpdateIndex - toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange);
-				int startRow = toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - BUFFER_SIZE;
-				int endRow = toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - BUFFER_SIZE + nbRows - 1;
-				int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-				int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, true});
-			}
-			// move front
-			if(toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) > inferiorRowLastUpdateIndex)
-			{
-				int nbRows = toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - inferiorRowLastUpdateIndex;
-				int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-				int endRow = inferiorRowLastUpdateIndex - BUFFER_SIZE + nbRows - 1;
-				int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-				int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, false});
-			}
-			inferiorRowLastUpdateIndex = toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange);
+			localPointCloudCells.emplace(cellIds[i], Cell{std::move(cells[i]), VoxelHash(minDistNewPoint), localPointCloudVersion, {}});
 		}
-
-		// manage cells in front
-		if(std::abs(toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - superiorRowLastUpdateIndex) >= 2)
+		else
 		{
-			// move back
-			if(toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) < superiorRowLastUpdateIndex)
+			// points are appended, so the voxel hash of the cell stays valid
+			cell->second.appendedPoints.push_back(std::make_pair(localPointCloudVersion, cell->second.points.getNbPoints()));
+			if(cell->second.appendedPoints.size() > MAX_NB_TRACKED_CELL_APPENDS)
 			{
-				int nbRows = superiorRowLastUpdateIndex - toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange);
-				int startRow = superiorRowLastUpdateIndex + BUFFER_SIZE - nbRows + 1;
-				int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-				int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-				int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, false});
+				// clients older than the forgotten append get the whole cell
+				cell->second.version = cell->second.appendedPoints.front().first;
+				cell->second.appendedPoints.erase(cell->second.appendedPoints.begin());
 			}
-			// move front
-			if(toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) > superiorRowLastUpdateIndex)
-			{
-				int nbRows = toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - superiorRowLastUpdateIndex;
-				int startRow = toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) + BUFFER_SIZE - nbRows + 1;
-				int endRow = toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) + BUFFER_SIZE;
-				int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-				int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, true});
-			}
-			superiorRowLastUpdateIndex = toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange);
+			cell->second.points = DataPointsMerger::merge(cell->second.points, cells[i]);
 		}
+	}
+}
+
+void norlab_icp_mapper::Map::rebuildLocalPointCloud()
+{
+	// the ICP matcher only indexes again the cells which changed since the version it last saw them at
+	std::vector<const PM::DataPoints*> cells;
+	std::vector<ReferenceBlock> blocks;
+	int nbPoints = 0;
+	for(const auto& cell: localPointCloudCells)
+	{
+		cells.push_back(&cell.second.points);
+		const std::uint64_t version = cell.second.appendedPoints.empty() ? cell.second.version :
+									  std::max(cell.second.version, cell.second.appendedPoints.back().first);
+		blocks.push_back(ReferenceBlock{cell.first, 0, version, nbPoints, static_cast<int>(cell.second.points.getNbPoints())});
+		nbPoints += cell.second.points.getNbPoints();
+	}
+	localPointCloud = std::make_shared<const PM::DataPoints>(DataPointsMerger::merge(cells));
 
-		// update cells to the right
-		if(std::abs(toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - inferiorColumnLastUpdateIndex) >= 2)
+	{
+		// in submap mode, inputs are registered against the active submap and the frozen cells around it, which are never modified in place
+		Profiler::Span setMapSpan(profiler, Profiler::SET_MAP);
+		if(neighborFrozenCells.empty())
 		{
-			// move right
-			if(toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) < inferiorColumnLastUpdateIndex)
-			{
-				int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-				int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-				int nbColumns = inferiorColumnLastUpdateIndex - toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange);
-				int startColumn = toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - BUFFER_SIZE;
-				int endColumn = toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - BUFFER_SIZE + nbColumns - 1;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, true});
-			}
-			// move left
-			if(toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) > inferiorColumnLastUpdateIndex)
+			icp.setMap(*localPointCloud, blocks);
+		}
+		else
+		{
+			for(const auto& cell: neighborFrozenCells)
 			{
-				int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-				int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-				int nbColumns = toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - inferiorColumnLastUpdateIndex;
-				int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-				int endColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE + nbColumns - 1;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, false});
+				cells.push_back(&cell.second.points);
+				blocks.push_back(ReferenceBlock{cell.first, 1, cell.second.version, nbPoints, static_cast<int>(cell.second.points.getNbPoints())});
+				nbPoints += cell.second.points.getNbPoints();
 			}
-			inferiorColumnLastUpdateIndex = toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange);
+			icp.setMap(DataPointsMerger::merge(cells), blocks);
 		}
+	}
+
+	localPointCloudSize.store(localPointCloud->getNbPoints());
+	nbLocalPointCloudCells.store(localPointCloudCells.size());
+	localPointCloudEmpty.store(localPointCloud->getNbPoints() == 0 && neighborFrozenCells.empty());
+	newLocalPointCloudAvailable = true;
+}
+
+void norlab_icp_mapper::Map::lockLocalPointCloud()
+{
+	Profiler::Span lockWaitSpan(profiler, Profiler::LOCAL_POINT_CLOUD_LOCK_WAIT);
+	localPointCloudLock.lock();
+}
 
-		// update cells to the left
-		if(std::abs(toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - superiorColumnLastUpdateIndex) >= 2)
+void norlab_icp_mapper::Map::clonePostFilters(const PM::DataPointsFilters& postFilters, const int& nbClones)
+{
+	// clones are kept between updates as long as the chain is the same, so that the state of the filters carries over
+	if(clonedPostFilters != postFilters)
+	{
+		clonedPostFilters = postFilters;
+		postFilterClones.clear();
+	}
+	while(postFilterClones.size() < nbClones)
+	{
+		PM::DataPointsFilters clone;
+		for(const auto& filter: postFilters)
 		{
-			// move right
-			if(toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) < superiorColumnLastUpdateIndex)
-			{
-				int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-				int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-				int nbColumns = superiorColumnLastUpdateIndex - toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange);
-				int startColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE - nbColumns + 1;
-				int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, false});
-			}
-			// move left
-			if(toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) > superiorColumnLastUpdateIndex)
-			{
-				int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-				int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-				int nbColumns = toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - superiorColumnLastUpdateIndex;
-				int startColumn = toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) + BUFFER_SIZE - nbColumns + 1;
-				int endColumn = toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) + BUFFER_SIZE;
-				int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-				int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-				scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, true});
-			}
-			superiorColumnLastUpdateIndex = toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange);
+			clone.push_back(PM::get().DataPointsFilterRegistrar.create(filter->className, filter->parameters));
 		}
+		postFilterClones.push_back(clone);
+	}
+}
 
-		if(is3D)
+norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::applyPostFilters(const CellId& cellId, const PM::TransformationParameters& pose,
+																				 PM::DataPointsFilters& postFilters) const
+{
+	const Cell& cell = localPointCloudCells.at(cellId);
+	PM::DataPoints cellPoints = cell.points;
+	cellPoints.addDescriptor("postFilterCell", PM::Matrix::Ones(1, cellPoints.getNbPoints()));
+
+	// points of the neighboring cells within the margin of the borders are filtered along with the cell and dropped afterwards; the result is
+	// the same as when the whole local map is filtered as long as the filters only look at the neighbors of a point within the margin, like
+	// a SurfaceNormal filter whose knn neighbors are all that close, and do not depend on the whole cloud, like a RandomSampling or MaxPointCount
+	const int euclideanDim = is3D ? 3 : 2;
+	const int cellCoordinates[3] = {toRow(cellId), toColumn(cellId), toAisle(cellId)};
+	const int aisleRange = is3D ? 1 : 0;
+	std::vector<PM::DataPoints> neighborhoodPoints;
+	for(int i = -1; i <= 1; i++)
+	{
+		for(int j = -1; j <= 1; j++)
 		{
-			// update cells below
-			if(std::abs(toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - inferiorAisleLastUpdateIndex) >= 2)
+			for(int k = -aisleRange; k <= aisleRange; k++)
 			{
-				// move down
-				if(toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) < inferiorAisleLastUpdateIndex)
-				{
-					int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-					int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-					int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-					int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-					int nbAisles = inferiorAisleLastUpdateIndex - toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange);
-					int startAisle = toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - BUFFER_SIZE;
-					int endAisle = toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - BUFFER_SIZE + nbAisles - 1;
-					scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, true});
-				}
-				// move up
-				if(toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) > inferiorAisleLastUpdateIndex)
+				auto neighbor = localPointCloudCells.find(toCellId(cellCoordinates[0] + i, cellCoordinates[1] + j, cellCoordinates[2] + k));
+				if((i == 0 && j == 0 && k == 0) || neighbor == localPointCloudCells.end())
 				{
-					int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-					int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-					int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-					int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-					int nbAisles = toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - inferiorAisleLastUpdateIndex;
-					int startAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE;
-					int endAisle = inferiorAisleLastUpdateIndex - BUFFER_SIZE + nbAisles - 1;
-					scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, false});
+					continue;
 				}
-				inferiorAisleLastUpdateIndex = toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange);
-			}
 
-			// update cells above
-			if(std::abs(toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - superiorAisleLastUpdateIndex) >= 2)
-			{
-				// move down
-				if(toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) < superiorAisleLastUpdateIndex)
+				const PM::Matrix& neighborFeatures = neighbor->second.points.features;
+				std::vector<int> pointIds;
+				for(int l = 0; l < neighborFeatures.cols(); l++)
 				{
-					int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-					int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-					int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-					int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-					int nbAisles = superiorAisleLastUpdateIndex - toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange);
-					int startAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE - nbAisles + 1;
-					int endAisle = superiorAisleLastUpdateIndex + BUFFER_SIZE;
-					scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, false});
+					bool isWithinMargin = true;
+					for(int m = 0; m < euclideanDim && isWithinMargin; m++)
+					{
+						const float inferiorBound = cellCoordinates[m] * cellSize;
+						isWithinMargin = neighborFeatures(m, l) >= inferiorBound - postFilterMargin &&
+										 neighborFeatures(m, l) < inferiorBound + cellSize + postFilterMargin;
+					}
+					if(isWithinMargin)
+					{
+						pointIds.push_back(l);
+					}
 				}
-				// move up
-				if(toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) > superiorAisleLastUpdateIndex)
+				if(!pointIds.empty())
 				{
-					int startRow = inferiorRowLastUpdateIndex - BUFFER_SIZE;
-					int endRow = superiorRowLastUpdateIndex + BUFFER_SIZE;
-					int startColumn = inferiorColumnLastUpdateIndex - BUFFER_SIZE;
-					int endColumn = superiorColumnLastUpdateIndex + BUFFER_SIZE;
-					int nbAisles = toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - superiorAisleLastUpdateIndex;
-					int startAisle = toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) + BUFFER_SIZE - nbAisles + 1;
-					int endAisle = toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) + BUFFER_SIZE;
-					scheduleUpdate(Update{startRow, endRow, startColumn, endColumn, startAisle, endAisle, true});
+					neighborhoodPoints.push_back(gatherPoints(neighbor->second.points, pointIds, 0, pointIds.size()));
+					neighborhoodPoints.back().addDescriptor("postFilterCell", PM::Matrix::Zero(1, pointIds.size()));
 				}
-				superiorAisleLastUpdateIndex = toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange);
 			}
 		}
 	}
-}
-
-int norlab_icp_mapper::Map::getMinGridCoordinate() const
-{
-	return std::numeric_limits<int>::lowest();
-}
 
-int norlab_icp_mapper::Map::getMaxGridCoordinate() const
-{
-	return std::numeric_limits<int>::max() - 1;
-}
+	std::vector<const PM::DataPoints*> regionPoints = {&cellPoints};
+	for(const auto& points: neighborhoodPoints)
+	{
+		regionPoints.push_back(&points);
+	}
+	PM::DataPoints regionInSensorFrame = transformation->compute(DataPointsMerger::merge(regionPoints), pose.inverse());
+	postFilters.apply(regionInSensorFrame);
 
-int norlab_icp_mapper::Map::toInferiorGridCoordinate(const float& worldCoordinate, const float& range) const
-{
-	return std::ceil(((worldCoordinate - range) / CELL_SIZE) - 1.0);
+	const auto cellFlags = regionInSensorFrame.getDescriptorViewByName("postFilterCell");
+	std::vector<int> cellPointIds;
+	for(int i = 0; i < regionInSensorFrame.getNbPoints(); i++)
+	{
+		if(cellFlags(0, i) > 0.5)
+		{
+			cellPointIds.push_back(i);
+		}
+	}
+	PM::DataPoints filteredCellInSensorFrame = gatherPoints(regionInSensorFrame, cellPointIds, 0, cellPointIds.size());
+	filteredCellInSensorFrame.removeDescriptor("postFilterCell");
+	return transformation->compute(filteredCellInSensorFrame, pose);
 }
 
-int norlab_icp_mapper::Map::toSuperiorGridCoordinate(const float& worldCoordinate, const float& range) const
+norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::gatherPoints(const PM::DataPoints& points, const std::vector<int>& pointIds,
+																			 const int& begin, const int& end) const
 {
-	return std::floor((worldCoordinate + range) / CELL_SIZE);
+	PM::DataPoints gatheredPoints = points.createSimilarEmpty(end - begin);
+	for(int i = begin; i < end; i++)
+	{
+		gatheredPoints.features.col(i - begin) = points.features.col(pointIds[i]);
+	}
+	for(int i = begin; i < end && points.descriptors.rows() > 0; i++)
+	{
+		gatheredPoints.descriptors.col(i - begin) = points.descriptors.col(pointIds[i]);
+	}
+	for(int i = begin; i < end && points.times.rows() > 0; i++)
+	{
+		gatheredPoints.times.col(i - begin) = points.times.col(pointIds[i]);
+	}
+	return gatheredPoints;
 }
 
-void norlab_icp_mapper::Map::scheduleUpdate(const Update& update)
+norlab_icp_mapper::Map::~Map()
 {
 	if(isOnline)
 	{
 		updateListLock.lock();
-		updateList.push_back(update);
+		updateThreadLooping.store(false);
 		updateListLock.unlock();
+		updateListCondition.notify_one();
+		updateThread.join();
 	}
-	else
+
+	// the cells still loaded are written back, so that the next session opens the whole map
+	if(isMapPersistent)
 	{
-		applyUpdate(update);
+		std::lock_guard<std::mutex> cellTransferGuard(cellTransferLock);
+		std::lock_guard<std::mutex> localPointCloudGuard(localPointCloudLock);
+		std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+		for(auto& cell: localPointCloudCells)
+		{
+			cellManager->saveCell(cell.first, std::move(cell.second.points));
+		}
+		localPointCloudCells.clear();
+		cellManager->flush();
 	}
-}
 
-norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::getLocalPointCloud()
-{
-	std::lock_guard<std::mutex> lock(localPointCloudLock);
-	return localPointCloud;
+	// frozen cells only last for the session, their store removes its files and then the folder it was given
+	if(!frozenCellFolder.empty())
+	{
+		frozenCellManager.reset();
+		std::remove(frozenCellFolder.c_str());
+	}
 }
 
-void norlab_icp_mapper::Map::updateLocalPointCloud(PM::DataPoints input, PM::TransformationParameters pose, PM::DataPointsFilters postFilters)
+void norlab_icp_mapper::Map::updatePose(const PM::TransformationParameters& pose, const PM::Vector& velocity)
 {
-	if(computeProbDynamic)
+	GridWindow window = toLoadedWindow(pose);
+	if(firstPoseUpdate.load())
 	{
-		input.addDescriptor("probabilityDynamic", PM::Matrix::Constant(1, input.features.cols(), priorDynamic));
-	}
+		lockLocalPointCloud();
+		loadedCellIds.clear();
+		localPointCloudLock.unlock();
 
-	localPointCloudLock.lock();
-	if(localPointCloudEmpty.load())
-	{
-		localPointCloud = input;
+		unloadCells(getMinGridCoordinate(), getMaxGridCoordinate(), getMinGridCoordinate(),
+					getMaxGridCoordinate(), getMinGridCoordinate(), getMaxGridCoordinate());
+		loadCells(window.startRow, window.endRow, window.startColumn, window.endColumn, window.startAisle, window.endAisle);
+		loadedWindow = window;
+
+		activeSubmapOrigin = pose.topRightCorner(is3D ? 3 : 2, 1);
+		firstPoseUpdate.store(false);
 	}
 	else
 	{
-		if(computeProbDynamic)
+		// a bound only moves once it is two cells away, so that a robot going back and forth across a cell edge does not reload the same cells
+		auto moveBound = [](const int& bound, const int& newBound)
+		{
+			return std::abs(newBound - bound) >= 2 ? newBound : bound;
+		};
+		window = {moveBound(loadedWindow.startRow, window.startRow), moveBound(loadedWindow.endRow, window.endRow),
+				  moveBound(loadedWindow.startColumn, window.startColumn), moveBound(loadedWindow.endColumn, window.endColumn),
+				  moveBound(loadedWindow.startAisle, window.startAisle), moveBound(loadedWindow.endAisle, window.endAisle)};
+
+		// the cells leaving the window are unloaded before the ones entering it are loaded, the regions being disjoint
+		std::vector<Update> updates;
+		for(const GridWindow& region: subtractGridWindows(loadedWindow, window))
+		{
+			updates.push_back(Update{region.startRow, region.endRow, region.startColumn, region.endColumn, region.startAisle, region.endAisle, UNLOAD});
+		}
+		for(const GridWindow& region: subtractGridWindows(window, loadedWindow))
 		{
-			computeProbabilityOfPointsBeingDynamic(input, localPointCloud, pose);
+			updates.push_back(Update{region.startRow, region.endRow, region.startColumn, region.endColumn, region.startAisle, region.endAisle, LOAD});
 		}
+		loadedWindow = window;
+		scheduleUpdates(updates);
 
-		PM::DataPoints inputPointsToKeep = retrievePointsFurtherThanMinDistNewPoint(input, localPointCloud, pose);
-		localPointCloud.concatenate(inputPointsToKeep);
+		if(isOnline)
+		{
+			prefetchCells(pose, velocity);
+		}
 	}
 
-	PM::DataPoints localPointCloudInSensorFrame = transformation->compute(localPointCloud, pose.inverse());
-	postFilters.apply(localPointCloudInSensorFrame);
-	localPointCloud = transformation->compute(localPointCloudInSensorFrame, pose);
+	if(submapLength > 0)
+	{
+		updateSubmaps(pose);
+	}
+}
 
-	icpMapLock.lock();
-	icp.setMap(localPointCloud);
-	icpMapLock.unlock();
+bool norlab_icp_mapper::Map::isCellInGridWindow(const CellId& cellId, const GridWindow& window) const
+{
+	const int row = toRow(cellId);
+	const int column = toColumn(cellId);
+	const int aisle = toAisle(cellId);
+	return row >= window.startRow && row <= window.endRow && column >= window.startColumn && column <= window.endColumn && aisle >= window.startAisle &&
+		   aisle <= window.endAisle;
+}
 
-	localPointCloudEmpty.store(localPointCloud.getNbPoints() == 0);
-	newLocalPointCloudAvailable = true;
-	localPointCloudLock.unlock();
-}
-
-void norlab_icp_mapper::Map::computeProbabilityOfPointsBeingDynamic(const PM::DataPoints& input, PM::DataPoints& currentLocalPointCloud,
-																	const PM::TransformationParameters& pose) const
+void norlab_icp_mapper::Map::updateSubmaps(const PM::TransformationParameters& pose)
 {
-	typedef Nabo::NearestNeighbourSearch<float> NNS;
-	const float eps = 0.0001;
-
-	PM::DataPoints inputInSensorFrame = transformation->compute(input, pose.inverse());
+	// freezing the active submap and gathering the frozen cells go through the cell stores, so they are left to the update thread
+	const PM::Vector position = pose.topRightCorner(is3D ? 3 : 2, 1);
+	std::vector<Update> updates;
+	if((position - activeSubmapOrigin).norm() > submapLength)
+	{
+		activeSubmapOrigin = position;
+		updates.push_back(Update{getMinGridCoordinate(), getMaxGridCoordinate(), getMinGridCoordinate(), getMaxGridCoordinate(), getMinGridCoordinate(),
+								 getMaxGridCoordinate(), FREEZE});
+	}
 
-	PM::Matrix inputInSensorFrameRadii;
-	PM::Matrix inputInSensorFrameAngles;
-	convertToSphericalCoordinates(inputInSensorFrame, inputInSensorFrameRadii, inputInSensorFrameAngles);
+	// the frozen cells registered against are the ones of the window of loaded cells
+	if(loadedWindow.startRow != neighborFrozenWindow.startRow || loadedWindow.endRow != neighborFrozenWindow.endRow ||
+	   loadedWindow.startColumn != neighborFrozenWindow.startColumn || loadedWindow.endColumn != neighborFrozenWindow.endColumn ||
+	   loadedWindow.startAisle != neighborFrozenWindow.startAisle || loadedWindow.endAisle != neighborFrozenWindow.endAisle)
+	{
+		neighborFrozenWindow = loadedWindow;
+		updates.push_back(Update{loadedWindow.startRow, loadedWindow.endRow, loadedWindow.startColumn, loadedWindow.endColumn, loadedWindow.startAisle,
+								 loadedWindow.endAisle, GATHER_FROZEN_CELLS});
+	}
+	scheduleUpdates(updates);
+}
 
-	PM::DataPoints currentLocalPointCloudInSensorFrame = transformation->compute(currentLocalPointCloud, pose.inverse());
-	PM::Matrix globalId(1, currentLocalPointCloud.getNbPoints());
-	int nbPointsWithinSensorMaxRange = 0;
-	for(int i = 0; i < currentLocalPointCloud.getNbPoints(); i++)
+void norlab_icp_mapper::Map::freezeActiveSubmap()
+{
+	std::lock_guard<std::mutex> cellTransferGuard(cellTransferLock);
+
+	// the cells of the active submap join the frozen cells around the robot right away, so that they stay in the registration map while they
+	// are written to the frozen store
+	lockLocalPointCloud();
+	localPointCloudVersion++;
+	const std::uint64_t version = localPointCloudVersion;
+	std::vector<CellId> cellIds;
+	std::vector<PM::DataPoints> cells;
+	for(auto& cell: localPointCloudCells)
 	{
-		if(currentLocalPointCloudInSensorFrame.features.col(i).head(currentLocalPointCloudInSensorFrame.getEuclideanDim()).norm() < sensorMaxRange)
+		auto neighborCell = neighborFrozenCells.find(cell.first);
+		if(neighborCell == neighborFrozenCells.end())
+		{
+			neighborFrozenCells.emplace(cell.first, FrozenCell{cell.second.points, version});
+		}
+		else
 		{
-			currentLocalPointCloudInSensorFrame.setColFrom(nbPointsWithinSensorMaxRange, currentLocalPointCloudInSensorFrame, i);
-			globalId(0, nbPointsWithinSensorMaxRange) = i;
-			nbPointsWithinSensorMaxRange++;
+			neighborCell->second = FrozenCell{DataPointsMerger::merge(neighborCell->second.points, cell.second.points), version};
 		}
+		cellIds.push_back(cell.first);
+		cells.push_back(std::move(cell.second.points));
+		recordLocalPointCloudCellRemoval(cell.first);
 	}
-	currentLocalPointCloudInSensorFrame.conservativeResize(nbPointsWithinSensorMaxRange);
+	localPointCloudCells.clear();
+	rebuildLocalPointCloud();
+	localPointCloudLock.unlock();
 
-	PM::Matrix currentLocalPointCloudInSensorFrameRadii;
-	PM::Matrix currentLocalPointCloudInSensorFrameAngles;
-	convertToSphericalCoordinates(currentLocalPointCloudInSensorFrame, currentLocalPointCloudInSensorFrameRadii, currentLocalPointCloudInSensorFrameAngles);
+	saveFrozenCells(cellIds, cells, version);
 
-	std::shared_ptr<NNS> nns = std::shared_ptr<NNS>(NNS::create(inputInSensorFrameAngles));
-	PM::Matches::Dists dists(1, currentLocalPointCloudInSensorFrame.getNbPoints());
-	PM::Matches::Ids ids(1, currentLocalPointCloudInSensorFrame.getNbPoints());
-	nns->knn(currentLocalPointCloudInSensorFrameAngles, ids, dists, 1, 0, NNS::ALLOW_SELF_MATCH, 2 * beamHalfAngle);
+	// cells of the active submap that were unloaded are frozen as well, a batch at a time so that they are never all read at once
+	cellManagerLock.lock();
+	const std::vector<CellId> savedCellIds = cellManager->getAllCellIds();
+	cellManagerLock.unlock();
+	for(int i = 0; i < savedCellIds.size(); i += NB_FROZEN_CELLS_PER_BATCH)
+	{
+		const std::vector<CellId> batchCellIds(savedCellIds.begin() + i,
+											   savedCellIds.begin() + std::min<std::size_t>(i + NB_FROZEN_CELLS_PER_BATCH, savedCellIds.size()));
+		std::vector<PM::DataPoints> batchCells;
+		{
+			Profiler::Span cellRetrievalSpan(profiler, Profiler::CELL_RETRIEVAL);
+			cellManagerLock.lock();
+			batchCells = cellManager->takeCells(batchCellIds);
+			cellManagerLock.unlock();
+		}
+		saveFrozenCells(batchCellIds, batchCells, version);
+	}
+	cellManagerLock.lock();
+	cellManager->clearAllCells();
+	cellManagerLock.unlock();
+}
 
-	PM::DataPoints::View viewOnProbabilityDynamic = currentLocalPointCloud.getDescriptorViewByName("probabilityDynamic");
-	PM::DataPoints::View viewOnNormals = currentLocalPointCloudInSensorFrame.getDescriptorViewByName("normals");
-	for(int i = 0; i < currentLocalPointCloudInSensorFrame.getNbPoints(); i++)
+void norlab_icp_mapper::Map::saveFrozenCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>& cells, const std::uint64_t& version)
+{
+	Profiler::Span cellSavingSpan(profiler, Profiler::CELL_SAVING);
+	std::lock_guard<std::mutex> frozenCellGuard(frozenCellLock);
+
+	// cells frozen with an earlier submap keep their points, the new ones being appended
+	std::vector<CellId> newCellIds;
+	std::vector<PM::DataPoints> newCells;
+	std::vector<CellId> mergedCellIds;
+	std::vector<PM::DataPoints> mergedCells;
+	for(int i = 0; i < cellIds.size(); i++)
 	{
-		if(dists(i) != std::numeric_limits<float>::infinity())
+		if(cells[i].getNbPoints() == 0)
+		{
+			continue;
+		}
+		if(frozenCellVersions.find(cellIds[i]) == frozenCellVersions.end())
+		{
+			newCellIds.push_back(cellIds[i]);
+			newCells.push_back(std::move(cells[i]));
+		}
+		else
 		{
-			const int inputPointId = ids(0, i);
-			const int localPointCloudPointId = globalId(0, i);
+			mergedCellIds.push_back(cellIds[i]);
+			mergedCells.push_back(std::move(cells[i]));
+		}
+		frozenCellVersions[cellIds[i]] = version;
+	}
 
-			const Eigen::VectorXf inputPoint = inputInSensorFrame.features.col(inputPointId).head(inputInSensorFrame.getEuclideanDim());
-			const Eigen::VectorXf
-					localPointCloudPoint = currentLocalPointCloudInSensorFrame.features.col(i).head(currentLocalPointCloudInSensorFrame.getEuclideanDim());
-			const float delta = (inputPoint - localPointCloudPoint).norm();
-			const float d_max = epsilonA * inputPoint.norm();
+	const std::vector<PM::DataPoints> oldCells = frozenCellManager->takeCells(mergedCellIds);
+	for(int i = 0; i < mergedCells.size(); i++)
+	{
+		mergedCells[i] = DataPointsMerger::merge(oldCells[i], mergedCells[i]);
+	}
+	frozenCellManager->saveCells(newCellIds, std::move(newCells));
+	frozenCellManager->saveCells(mergedCellIds, std::move(mergedCells));
+}
 
-			const Eigen::VectorXf localPointCloudPointNormal = viewOnNormals.col(i);
+void norlab_icp_mapper::Map::gatherNeighborFrozenCells(const GridWindow& window)
+{
+	std::lock_guard<std::mutex> cellTransferGuard(cellTransferLock);
 
-			const float w_v = eps + (1. - eps) * fabs(localPointCloudPointNormal.dot(localPointCloudPoint.normalized()));
-			const float w_d1 = eps + (1. - eps) * (1. - sqrt(dists(i)) / (2 * beamHalfAngle));
+	lockLocalPointCloud();
+	std::unordered_map<CellId, std::uint64_t, CellIdHash> currentVersions;
+	for(const auto& cell: neighborFrozenCells)
+	{
+		currentVersions.emplace(cell.first, cell.second.version);
+	}
+	localPointCloudLock.unlock();
 
-			const float offset = delta - epsilonD;
-			float w_d2 = 1.;
-			if(delta < epsilonD || localPointCloudPoint.norm() > inputPoint.norm())
+	// the window can span more cells than were ever frozen, in which case the frozen cells are visited instead of the window
+	std::vector<CellId> windowCellIds;
+	std::vector<CellId> cellIdsToRetrieve;
+	std::vector<std::uint64_t> retrievedVersions;
+	std::vector<PM::DataPoints> retrievedCells;
+	{
+		std::lock_guard<std::mutex> frozenCellGuard(frozenCellLock);
+		const double nbWindowCells = (static_cast<double>(window.endRow) - window.startRow + 1) *
+									 (static_cast<double>(window.endColumn) - window.startColumn + 1) *
+									 (static_cast<double>(window.endAisle) - window.startAisle + 1);
+		if(nbWindowCells > frozenCellVersions.size())
+		{
+			for(const auto& frozenCell: frozenCellVersions)
 			{
-				w_d2 = eps;
+				if(isCellInGridWindow(frozenCell.first, window))
+				{
+					windowCellIds.push_back(frozenCell.first);
+				}
 			}
-			else
+		}
+		else
+		{
+			for(int i = window.startRow; i <= window.endRow; i++)
 			{
-				if(offset < d_max)
+				for(int j = window.startColumn; j <= window.endColumn; j++)
 				{
-					w_d2 = eps + (1 - eps) * offset / d_max;
+					for(int k = window.startAisle; k <= window.endAisle; k++)
+					{
+						if(frozenCellVersions.find(toCellId(i, j, k)) != frozenCellVersions.end())
+						{
+							windowCellIds.push_back(toCellId(i, j, k));
+						}
+					}
 				}
 			}
+		}
 
-			float w_p2 = eps;
-			if(delta < epsilonD)
+		// only the cells which are new to the window or were frozen again since they were gathered are read
+		for(const auto& cellId: windowCellIds)
+		{
+			const std::uint64_t version = frozenCellVersions[cellId];
+			auto currentVersion = currentVersions.find(cellId);
+			if(currentVersion == currentVersions.end() || currentVersion->second != version)
 			{
-				w_p2 = 1;
+				cellIdsToRetrieve.push_back(cellId);
+				retrievedVersions.push_back(version);
 			}
-			else
+		}
+		Profiler::Span cellRetrievalSpan(profiler, Profiler::CELL_RETRIEVAL);
+		retrievedCells = frozenCellManager->retrieveCells(cellIdsToRetrieve);
+	}
+
+	lockLocalPointCloud();
+	for(auto cell = neighborFrozenCells.begin(); cell != neighborFrozenCells.end();)
+	{
+		if(isCellInGridWindow(cell->first, window))
+		{
+			++cell;
+		}
+		else
+		{
+			cell = neighborFrozenCells.erase(cell);
+		}
+	}
+	for(int i = 0; i < cellIdsToRetrieve.size(); i++)
+	{
+		neighborFrozenCells[cellIdsToRetrieve[i]] = FrozenCell{std::move(retrievedCells[i]), retrievedVersions[i]};
+	}
+	rebuildLocalPointCloud();
+	localPointCloudLock.unlock();
+}
+
+void norlab_icp_mapper::Map::prefetchCells(const PM::TransformationParameters& pose, const PM::Vector& velocity)
+{
+	// predict where the robot will be in a short while, without going further than the buffer
+	const int euclideanDim = is3D ? 3 : 2;
+	PM::Vector displacement = velocity.head(euclideanDim) * PREFETCH_HORIZON;
+	if(displacement.norm() > bufferSize * cellSize)
+	{
+		displacement *= bufferSize * cellSize / displacement.norm();
+	}
+	const PM::Vector predictedPosition = pose.topRightCorner(euclideanDim, 1) + displacement;
+
+	int startGridCoordinates[3] = {0, 0, 0};
+	int endGridCoordinates[3] = {0, 0, 0};
+	for(int i = 0; i < euclideanDim; i++)
+	{
+		startGridCoordinates[i] = toInferiorGridCoordinate(predictedPosition(i), sensorMaxRange) - bufferSize;
+		endGridCoordinates[i] = toSuperiorGridCoordinate(predictedPosition(i), sensorMaxRange) + bufferSize;
+	}
+
+	std::vector<CellId> cellIds;
+	lockLocalPointCloud();
+	for(int i = startGridCoordinates[0]; i <= endGridCoordinates[0]; i++)
+	{
+		for(int j = startGridCoordinates[1]; j <= endGridCoordinates[1]; j++)
+		{
+			for(int k = startGridCoordinates[2]; k <= endGridCoordinates[2]; k++)
 			{
-				if(offset < d_max)
+				if(loadedCellIds.find(toCellId(i, j, k)) == loadedCellIds.end())
 				{
-					w_p2 = eps + (1. - eps) * (1. - offset / d_max);
+					cellIds.push_back(toCellId(i, j, k));
 				}
 			}
+		}
+	}
+	localPointCloudLock.unlock();
 
-			if((inputPoint.norm() + epsilonD + d_max) >= localPointCloudPoint.norm())
-			{
-				const float lastDyn = viewOnProbabilityDynamic(0, localPointCloudPointId);
+	cellManagerLock.lock();
+	cellManager->prefetchCells(cellIds);
+	cellManagerLock.unlock();
+}
 
-				const float c1 = (1 - (w_v * w_d1));
-				const float c2 = w_v * w_d1;
+int norlab_icp_mapper::Map::getMinGridCoordinate() const
+{
+	return std::numeric_limits<int>::lowest();
+}
 
-				float probDynamic;
-				float probStatic;
-				if(lastDyn < thresholdDynamic)
+int norlab_icp_mapper::Map::getMaxGridCoordinate() const
+{
+	return std::numeric_limits<int>::max() - 1;
+}
+
+int norlab_icp_mapper::Map::toInferiorGridCoordinate(const float& worldCoordinate, const float& range) const
+{
+	return std::ceil(((worldCoordinate - range) / cellSize) - 1.0);
+}
+
+int norlab_icp_mapper::Map::toSuperiorGridCoordinate(const float& worldCoordinate, const float& range) const
+{
+	return std::floor((worldCoordinate + range) / cellSize);
+}
+
+norlab_icp_mapper::Map::GridWindow norlab_icp_mapper::Map::toLoadedWindow(const PM::TransformationParameters& pose) const
+{
+	const int positionColumn = is3D ? 3 : 2;
+	GridWindow window = {toInferiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) - bufferSize,
+						 toSuperiorGridCoordinate(pose(0, positionColumn), sensorMaxRange) + bufferSize,
+						 toInferiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) - bufferSize,
+						 toSuperiorGridCoordinate(pose(1, positionColumn), sensorMaxRange) + bufferSize, 0, 0};
+	if(is3D)
+	{
+		window.startAisle = toInferiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) - bufferSize;
+		window.endAisle = toSuperiorGridCoordinate(pose(2, positionColumn), sensorMaxRange) + bufferSize;
+	}
+	return window;
+}
+
+std::vector<norlab_icp_mapper::Map::GridWindow> norlab_icp_mapper::Map::subtractGridWindows(const GridWindow& window,
+																						 const GridWindow& subtractedWindow) const
+{
+	if(window.startRow > subtractedWindow.endRow || window.endRow < subtractedWindow.startRow || window.startColumn > subtractedWindow.endColumn ||
+	   window.endColumn < subtractedWindow.startColumn || window.startAisle > subtractedWindow.endAisle || window.endAisle < subtractedWindow.startAisle)
+	{
+		return {window};
+	}
+
+	// slabs are cut off one axis at a time, the remainder shrinking to the intersection, so that at most six disjoint regions are produced
+	std::vector<GridWindow> difference;
+	GridWindow remainder = window;
+	if(remainder.startRow < subtractedWindow.startRow)
+	{
+		difference.push_back({remainder.startRow, subtractedWindow.startRow - 1, remainder.startColumn, remainder.endColumn, remainder.startAisle,
+							  remainder.endAisle});
+		remainder.startRow = subtractedWindow.startRow;
+	}
+	if(remainder.endRow > subtractedWindow.endRow)
+	{
+		difference.push_back({subtractedWindow.endRow + 1, remainder.endRow, remainder.startColumn, remainder.endColumn, remainder.startAisle,
+							  remainder.endAisle});
+		remainder.endRow = subtractedWindow.endRow;
+	}
+	if(remainder.startColumn < subtractedWindow.startColumn)
+	{
+		difference.push_back({remainder.startRow, remainder.endRow, remainder.startColumn, subtractedWindow.startColumn - 1, remainder.startAisle,
+							  remainder.endAisle});
+		remainder.startColumn = subtractedWindow.startColumn;
+	}
+	if(remainder.endColumn > subtractedWindow.endColumn)
+	{
+		difference.push_back({remainder.startRow, remainder.endRow, subtractedWindow.endColumn + 1, remainder.endColumn, remainder.startAisle,
+							  remainder.endAisle});
+		remainder.endColumn = subtractedWindow.endColumn;
+	}
+	if(remainder.startAisle < subtractedWindow.startAisle)
+	{
+		difference.push_back({remainder.startRow, remainder.endRow, remainder.startColumn, remainder.endColumn, remainder.startAisle,
+							  subtractedWindow.startAisle - 1});
+	}
+	if(remainder.endAisle > subtractedWindow.endAisle)
+	{
+		difference.push_back({remainder.startRow, remainder.endRow, remainder.startColumn, remainder.endColumn, subtractedWindow.endAisle + 1,
+							  remainder.endAisle});
+	}
+	return difference;
+}
+
+void norlab_icp_mapper::Map::scheduleUpdates(const std::vector<Update>& updates)
+{
+	if(updates.empty())
+	{
+		return;
+	}
+
+	if(isOnline)
+	{
+		updateListLock.lock();
+		for(const Update& update: updates)
+		{
+			// an update of the same range as a pending one either repeats it or cancels it, unless an update in between touches that range,
+			// submap updates never being coalesced
+			bool isUpdateCoalesced = false;
+			for(auto pendingUpdate = updateList.rbegin(); pendingUpdate != updateList.rend(); ++pendingUpdate)
+			{
+				if(update.type == FREEZE || update.type == GATHER_FROZEN_CELLS || pendingUpdate->type == FREEZE ||
+				   pendingUpdate->type == GATHER_FROZEN_CELLS)
 				{
-					probDynamic = c1 * lastDyn + c2 * w_d2 * ((1 - alpha) * (1 - lastDyn) + beta * lastDyn);
-					probStatic = c1 * (1 - lastDyn) + c2 * w_p2 * (alpha * (1 - lastDyn) + (1 - beta) * lastDyn);
+					break;
 				}
-				else
+				if(pendingUpdate->startRow == update.startRow && pendingUpdate->endRow == update.endRow && pendingUpdate->startColumn == update.startColumn &&
+				   pendingUpdate->endColumn == update.endColumn && pendingUpdate->startAisle == update.startAisle && pendingUpdate->endAisle == update.endAisle)
 				{
-					probDynamic = 1 - eps;
-					probStatic = eps;
+					if(pendingUpdate->type != update.type)
+					{
+						updateList.erase(std::next(pendingUpdate).base());
+					}
+					isUpdateCoalesced = true;
+					break;
+				}
+				if(pendingUpdate->startRow <= update.endRow && pendingUpdate->endRow >= update.startRow && pendingUpdate->startColumn <= update.endColumn &&
+				   pendingUpdate->endColumn >= update.startColumn && pendingUpdate->startAisle <= update.endAisle && pendingUpdate->endAisle >= update.startAisle)
+				{
+					break;
 				}
+			}
+			if(!isUpdateCoalesced)
+			{
+				updateList.push_back(update);
+			}
+		}
+		updateListLock.unlock();
+		updateListCondition.notify_one();
+	}
+	else
+	{
+		for(const Update& update: updates)
+		{
+			applyUpdate(update);
+		}
+	}
+}
+
+norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::getLocalPointCloud()
+{
+	lockLocalPointCloud();
+	std::shared_ptr<const PM::DataPoints> currentLocalPointCloud = localPointCloud;
+	localPointCloudLock.unlock();
+	return *currentLocalPointCloud;
+}
+
+void norlab_icp_mapper::Map::updateLocalPointCloud(PM::DataPoints input, PM::TransformationParameters pose, PM::DataPointsFilters postFilters)
+{
+	if(computeProbDynamic)
+	{
+		input.addDescriptor("probabilityDynamic", PM::Matrix::Constant(1, input.features.cols(), priorDynamic));
+	}
+
+	lockLocalPointCloud();
+	localPointCloudVersion++;
+	std::vector<CellId> newCellIds;
+	std::vector<PM::DataPoints> newCells;
+	if(localPointCloudEmpty.load())
+	{
+		for(const auto& cell: localPointCloudCells)
+		{
+			recordLocalPointCloudCellRemoval(cell.first);
+		}
+		localPointCloudCells.clear();
+		partitionIntoCells(input, newCellIds, newCells);
+		addToLocalPointCloudCells(newCellIds, newCells);
+	}
+	else
+	{
+		// index the points added to the cells since the last update
+		for(auto& cell: localPointCloudCells)
+		{
+			cell.second.voxelHash.indexNewPoints(cell.second.points.features);
+		}
+
+		if(computeProbDynamic)
+		{
+			Profiler::Span dynamicProbabilitySpan(profiler, Profiler::DYNAMIC_PROBABILITY);
+			computeProbabilityOfPointsBeingDynamic(input, localPointCloudCells, pose, localPointCloudVersion);
+		}
+
+		Profiler::Span minDistInsertionSpan(profiler, Profiler::MIN_DIST_INSERTION);
+		PM::DataPoints inputPointsToKeep = retrievePointsFurtherThanMinDistNewPoint(input, localPointCloudCells, pose);
+		partitionIntoCells(inputPointsToKeep, newCellIds, newCells);
+		addToLocalPointCloudCells(newCellIds, newCells);
+	}
 
-				viewOnProbabilityDynamic(0, localPointCloudPointId) = probDynamic / (probDynamic + probStatic);
+	// only the cells whose points changed during this update are filtered again
+	std::vector<CellId> affectedCellIds;
+	for(const auto& cell: localPointCloudCells)
+	{
+		if(cell.second.version == localPointCloudVersion ||
+		   (!cell.second.appendedPoints.empty() && cell.second.appendedPoints.back().first == localPointCloudVersion))
+		{
+			affectedCellIds.push_back(cell.first);
+		}
+	}
+
+	// filters can keep a state, like a random number generator, so each block of cells filtered concurrently has its own copy of the chain
+	std::vector<PM::DataPoints> filteredCells(affectedCellIds.size());
+	{
+		Profiler::Span postFiltersSpan(profiler, Profiler::POST_FILTERS);
+		const int nbBlocks = std::max(1, std::min<int>(threadPool.getNbThreads(), affectedCellIds.size()));
+		const int blockSize = std::max<int>(1, (affectedCellIds.size() + nbBlocks - 1) / nbBlocks);
+		clonePostFilters(postFilters, nbBlocks);
+		threadPool.parallelForBlocks(affectedCellIds.size(), blockSize, [&](const int& begin, const int& end)
+		{
+			for(int i = begin; i < end; i++)
+			{
+				filteredCells[i] = applyPostFilters(affectedCellIds[i], pose, postFilterClones[begin / blockSize]);
 			}
+		});
+	}
+
+	for(int i = 0; i < affectedCellIds.size(); i++)
+	{
+		auto cell = localPointCloudCells.find(affectedCellIds[i]);
+		if(filteredCells[i].getNbPoints() == 0)
+		{
+			recordLocalPointCloudCellRemoval(cell->first);
+			localPointCloudCells.erase(cell);
+		}
+		else if(cell->second.points.getNbPoints() == filteredCells[i].getNbPoints())
+		{
+			// post filters keeping all the points of a cell are assumed to keep them in the same order, so only removals invalidate its voxel hash
+			cell->second.points = std::move(filteredCells[i]);
+			if(!postFilters.empty())
+			{
+				// descriptors of the points can have been rewritten, so clients get the whole cell again
+				cell->second.version = localPointCloudVersion;
+				cell->second.appendedPoints.clear();
+			}
+		}
+		else
+		{
+			localPointCloudCells.erase(cell);
+			localPointCloudCells.emplace(affectedCellIds[i], Cell{std::move(filteredCells[i]), VoxelHash(minDistNewPoint), localPointCloudVersion, {}});
 		}
 	}
+
+	rebuildLocalPointCloud();
+	localPointCloudLock.unlock();
 }
 
-norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::retrievePointsFurtherThanMinDistNewPoint(const PM::DataPoints& input,
-																										const PM::DataPoints& currentLocalPointCloud,
-																										const PM::TransformationParameters& pose) const
+void norlab_icp_mapper::Map::computeProbabilityOfPointsBeingDynamic(const PM::DataPoints& input, std::unordered_map<CellId, Cell, CellIdHash>& cells,
+																	const PM::TransformationParameters& pose, const std::uint64_t& version) const
 {
 	typedef Nabo::NearestNeighbourSearch<float> NNS;
+	const float eps = 0.0001;
+
+	PM::DataPoints inputInSensorFrame = transformation->compute(input, pose.inverse());
+
+	PM::Matrix inputInSensorFrameRadii;
+	PM::Matrix inputInSensorFrameAngles;
+	convertToSphericalCoordinates(inputInSensorFrame, inputInSensorFrameRadii, inputInSensorFrameAngles);
+
+	// only the cells intersecting the sensor range are visited
+	const int euclideanDim = input.getEuclideanDim();
+	const PM::Vector sensorPosition = pose.topRightCorner(euclideanDim, 1);
+	const float squaredSensorMaxRange = sensorMaxRange * sensorMaxRange;
+	std::vector<std::pair<const CellId, Cell>*> candidateCells;
+	for(auto& cell: cells)
+	{
+		candidateCells.push_back(&cell);
+	}
+	// the cells are only read until the probabilities are written back, so they are cropped concurrently
+	std::vector<std::vector<int>> candidateCellPointIds(candidateCells.size());
+	std::vector<PM::DataPoints> candidateCellPoints(candidateCells.size());
+	threadPool.parallelFor(candidateCells.size(), [&](const int& candidateCell)
+	{
+		const std::pair<const CellId, Cell>& cell = *candidateCells[candidateCell];
+		const int cellCoordinates[3] = {toRow(cell.first), toColumn(cell.first), toAisle(cell.first)};
+		float squaredDistanceToNearestCorner = 0;
+		float squaredDistanceToFarthestCorner = 0;
+		for(int i = 0; i < euclideanDim; i++)
+		{
+			const float inferiorBound = cellCoordinates[i] * cellSize;
+			const float nearestDelta = std::max(std::max(inferiorBound - sensorPosition(i), sensorPosition(i) - inferiorBound - cellSize), 0.0f);
+			const float farthestDelta = std::max(sensorPosition(i) - inferiorBound, inferiorBound + cellSize - sensorPosition(i));
+			squaredDistanceToNearestCorner += nearestDelta * nearestDelta;
+			squaredDistanceToFarthestCorner += farthestDelta * farthestDelta;
+		}
+		if(squaredDistanceToNearestCorner >= squaredSensorMaxRange)
+		{
+			return;
+		}
+
+		const PM::DataPoints& cellPoints = cell.second.points;
+		std::vector<int> pointIds;
+		if(squaredDistanceToFarthestCorner < squaredSensorMaxRange)
+		{
+			// points of cells entirely within range do not need to be checked individually
+			for(int i = 0; i < cellPoints.getNbPoints(); i++)
+			{
+				pointIds.push_back(i);
+			}
+		}
+		else
+		{
+			const Eigen::ArrayXf squaredDistances = (cellPoints.features.topRows(euclideanDim).colwise() - sensorPosition).colwise().squaredNorm().transpose().array();
+			for(int i = 0; i < cellPoints.getNbPoints(); i++)
+			{
+				if(squaredDistances(i) < squaredSensorMaxRange)
+				{
+					pointIds.push_back(i);
+				}
+			}
+		}
+
+		if(!pointIds.empty())
+		{
+			candidateCellPoints[candidateCell] = gatherPoints(cellPoints, pointIds, 0, pointIds.size());
+			candidateCellPointIds[candidateCell] = std::move(pointIds);
+		}
+	});
+
+	std::vector<Cell*> cellsWithinRange;
+	std::vector<std::vector<int>> cellPointIdsWithinRange;
+	std::vector<PM::DataPoints> cellPointsWithinRange;
+	for(int i = 0; i < candidateCells.size(); i++)
+	{
+		if(!candidateCellPointIds[i].empty())
+		{
+			cellsWithinRange.push_back(&candidateCells[i]->second);
+			cellPointsWithinRange.push_back(std::move(candidateCellPoints[i]));
+			cellPointIdsWithinRange.push_back(std::move(candidateCellPointIds[i]));
+		}
+	}
+	if(cellPointsWithinRange.empty())
+	{
+		return;
+	}
+	std::vector<const PM::DataPoints*> pointsWithinRange;
+	for(const auto& cellPoints: cellPointsWithinRange)
+	{
+		pointsWithinRange.push_back(&cellPoints);
+	}
+	PM::DataPoints currentLocalPointCloudInSensorFrame = transformation->compute(DataPointsMerger::merge(pointsWithinRange), pose.inverse());
+
+	PM::Matrix currentLocalPointCloudInSensorFrameRadii;
+	PM::Matrix currentLocalPointCloudInSensorFrameAngles;
+	convertToSphericalCoordinates(currentLocalPointCloudInSensorFrame, currentLocalPointCloudInSensorFrameRadii, currentLocalPointCloudInSensorFrameAngles);
+
+	PM::Matches::Dists dists(1, currentLocalPointCloudInSensorFrame.getNbPoints());
+	PM::Matches::Ids ids(1, currentLocalPointCloudInSensorFrame.getNbPoints());
+	if(beamSearchMethod == "rangeImage")
+	{
+		RangeImage rangeImage(inputInSensorFrameAngles, 2 * beamHalfAngle);
+		rangeImage.findClosestBeams(currentLocalPointCloudInSensorFrameAngles, 2 * beamHalfAngle, ids, dists);
+	}
+	else
+	{
+		std::shared_ptr<NNS> nns = std::shared_ptr<NNS>(NNS::create(inputInSensorFrameAngles));
+		nns->knn(currentLocalPointCloudInSensorFrameAngles, ids, dists, 1, 0, NNS::ALLOW_SELF_MATCH, 2 * beamHalfAngle);
+	}
 
-	PM::Matches matches(PM::Matches::Dists(1, input.getNbPoints()), PM::Matches::Ids(1, input.getNbPoints()));
-	std::shared_ptr<NNS> nns = std::shared_ptr<NNS>(NNS::create(currentLocalPointCloud.features, currentLocalPointCloud.features.rows() - 1,
-																NNS::KDTREE_LINEAR_HEAP, NNS::TOUCH_STATISTICS));
+	// gather the map points matched with a beam in contiguous matrices
+	std::vector<int> matchedPointIds;
+	for(int i = 0; i < currentLocalPointCloudInSensorFrame.getNbPoints(); i++)
+	{
+		if(dists(i) != std::numeric_limits<float>::infinity())
+		{
+			matchedPointIds.push_back(i);
+		}
+	}
+	const int nbMatchedPoints = matchedPointIds.size();
+	PM::DataPoints::View viewOnProbabilityDynamic = currentLocalPointCloudInSensorFrame.getDescriptorViewByName("probabilityDynamic");
+	PM::DataPoints::View viewOnNormals = currentLocalPointCloudInSensorFrame.getDescriptorViewByName("normals");
+	Eigen::ArrayXf newDyn(nbMatchedPoints);
+	threadPool.parallelForBlocks(nbMatchedPoints, PARALLEL_BLOCK_SIZE, [&](const int& begin, const int& end)
+	{
+		const int nbBlockPoints = end - begin;
+		PM::Matrix inputPoints(euclideanDim, nbBlockPoints);
+		PM::Matrix localPointCloudPoints(euclideanDim, nbBlockPoints);
+		PM::Matrix localPointCloudPointNormals(euclideanDim, nbBlockPoints);
+		Eigen::ArrayXf angularDists(nbBlockPoints);
+		Eigen::ArrayXf lastDyn(nbBlockPoints);
+		for(int i = 0; i < nbBlockPoints; i++)
+		{
+			const int pointId = matchedPointIds[begin + i];
+			inputPoints.col(i) = inputInSensorFrame.features.col(ids(0, pointId)).head(euclideanDim);
+			localPointCloudPoints.col(i) = currentLocalPointCloudInSensorFrame.features.col(pointId).head(euclideanDim);
+			localPointCloudPointNormals.col(i) = viewOnNormals.col(pointId).head(euclideanDim);
+			angularDists(i) = std::sqrt(dists(pointId));
+			lastDyn(i) = viewOnProbabilityDynamic(0, pointId);
+		}
+
+		// compute the probabilities of all the matched points of the block at once
+		const Eigen::ArrayXf inputPointNorms = inputPoints.colwise().norm().transpose().array();
+		const Eigen::ArrayXf localPointCloudPointNorms = localPointCloudPoints.colwise().norm().transpose().array();
+		const Eigen::ArrayXf delta = (inputPoints - localPointCloudPoints).colwise().norm().transpose().array();
+		const Eigen::ArrayXf d_max = epsilonA * inputPointNorms;
+
+		const Eigen::ArrayXf normalDotProducts = localPointCloudPointNormals.cwiseProduct(localPointCloudPoints).colwise().sum().transpose().array();
+		const Eigen::ArrayXf w_v = eps + (1.0f - eps) * (normalDotProducts / localPointCloudPointNorms).abs();
+		const Eigen::ArrayXf w_d1 = eps + (1.0f - eps) * (1.0f - angularDists / (2 * beamHalfAngle));
+
+		const Eigen::ArrayXf offset = delta - epsilonD;
+		const Eigen::ArrayXf w_d2 = ((delta < epsilonD) || (localPointCloudPointNorms > inputPointNorms)).select(
+				eps, (offset < d_max).select(eps + (1.0f - eps) * offset / d_max, 1.0f));
+		const Eigen::ArrayXf w_p2 = (delta < epsilonD).select(1.0f, (offset < d_max).select(eps + (1.0f - eps) * (1.0f - offset / d_max), eps));
+
+		const Eigen::ArrayXf c1 = 1.0f - (w_v * w_d1);
+		const Eigen::ArrayXf c2 = w_v * w_d1;
+		const Eigen::ArrayXf probDynamic = (lastDyn < thresholdDynamic).select(
+				c1 * lastDyn + c2 * w_d2 * ((1.0f - alpha) * (1.0f - lastDyn) + beta * lastDyn), 1.0f - eps);
+		const Eigen::ArrayXf probStatic = (lastDyn < thresholdDynamic).select(
+				c1 * (1.0f - lastDyn) + c2 * w_p2 * (alpha * (1.0f - lastDyn) + (1.0f - beta) * lastDyn), eps);
+		newDyn.segment(begin, nbBlockPoints) =
+				((inputPointNorms + epsilonD + d_max) >= localPointCloudPointNorms).select(probDynamic / (probDynamic + probStatic), lastDyn);
+	});
+
+	// write the probabilities back in the cells, matched points being sorted by cell
+	int cellWithinRange = 0;
+	int cellWithinRangeOffset = 0;
+	for(int i = 0; i < nbMatchedPoints; i++)
+	{
+		while(matchedPointIds[i] >= cellWithinRangeOffset + cellPointIdsWithinRange[cellWithinRange].size())
+		{
+			cellWithinRangeOffset += cellPointIdsWithinRange[cellWithinRange].size();
+			cellWithinRange++;
+		}
+		const int cellPointId = cellPointIdsWithinRange[cellWithinRange][matchedPointIds[i] - cellWithinRangeOffset];
+		cellsWithinRange[cellWithinRange]->points.getDescriptorViewByName("probabilityDynamic")(0, cellPointId) = newDyn(i);
+
+		// points of the cell changed, so the whole cell is part of the next deltas
+		cellsWithinRange[cellWithinRange]->version = version;
+		cellsWithinRange[cellWithinRange]->appendedPoints.clear();
+	}
+}
 
-	nns->knn(input.features, matches.ids, matches.dists, 1, 0);
+norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::retrievePointsFurtherThanMinDistNewPoint(const PM::DataPoints& input,
+																										const std::unordered_map<CellId, Cell, CellIdHash>& cells,
+																										const PM::TransformationParameters&) const
+{
+	return is3D ? retrievePointsFurtherThanMinDistNewPoint<3>(input, cells) : retrievePointsFurtherThanMinDistNewPoint<2>(input, cells);
+}
+
+template<int EuclideanDim>
+norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::retrievePointsFurtherThanMinDistNewPoint(const PM::DataPoints& input,
+																										const std::unordered_map<CellId, Cell, CellIdHash>& cells) const
+{
+	// the cells are only read, so the points are checked concurrently and kept in their original order afterwards
+	std::vector<char> isPointKept(input.getNbPoints());
+	threadPool.parallelForBlocks(input.getNbPoints(), PARALLEL_BLOCK_SIZE, [&](const int& begin, const int& end)
+	{
+		for(int i = begin; i < end; i++)
+		{
+			isPointKept[i] = isPointFurtherThanMinDistNewPoint<EuclideanDim>(input, i, cells);
+		}
+	});
 
 	int goodPointCount = 0;
 	PM::DataPoints goodPoints(input.createSimilarEmpty());
 	for(int i = 0; i < input.getNbPoints(); ++i)
 	{
-		if(matches.dists(i) >= std::pow(minDistNewPoint, 2))
+		if(isPointKept[i])
 		{
 			goodPoints.setColFrom(goodPointCount, input, i);
 			goodPointCount++;
@@ -677,28 +1389,124 @@ norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::retrievePointsFur
 	return goodPoints;
 }
 
+template<int EuclideanDim>
+bool norlab_icp_mapper::Map::isPointFurtherThanMinDistNewPoint(const PM::DataPoints& input, const int& pointId,
+															   const std::unordered_map<CellId, Cell, CellIdHash>& cells) const
+{
+	// look in every cell that can contain points closer than minDistNewPoint
+	const Eigen::Matrix<float, EuclideanDim, 1> point = input.features.col(pointId).template head<EuclideanDim>();
+	int inferiorGridCoordinates[3] = {0, 0, 0};
+	int superiorGridCoordinates[3] = {0, 0, 0};
+	for(int j = 0; j < EuclideanDim; j++)
+	{
+		inferiorGridCoordinates[j] = std::floor((point(j) - minDistNewPoint) / cellSize);
+		superiorGridCoordinates[j] = std::floor((point(j) + minDistNewPoint) / cellSize);
+	}
+
+	for(int j = inferiorGridCoordinates[0]; j <= superiorGridCoordinates[0]; j++)
+	{
+		for(int k = inferiorGridCoordinates[1]; k <= superiorGridCoordinates[1]; k++)
+		{
+			for(int l = inferiorGridCoordinates[2]; l <= superiorGridCoordinates[2]; l++)
+			{
+				auto cell = cells.find(toCellId(j, k, l));
+				if(cell != cells.end() &&
+				   cell->second.voxelHash.template containsPointWithinRange<EuclideanDim>(cell->second.points.features, input.features, pointId,
+																						  minDistNewPoint))
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+float norlab_icp_mapper::Map::estimateNewPointRatio(const PM::DataPoints& input)
+{
+	if(input.getNbPoints() == 0)
+	{
+		return 0;
+	}
+
+	lockLocalPointCloud();
+	for(auto& cell: localPointCloudCells)
+	{
+		cell.second.voxelHash.indexNewPoints(cell.second.points.features);
+	}
+
+	// evenly spaced points are checked, so that the estimate is deterministic
+	const int nbSamples = std::min<int>(input.getNbPoints(), NB_NEW_POINT_RATIO_SAMPLES);
+	int nbNewPoints = 0;
+	for(int i = 0; i < nbSamples; i++)
+	{
+		const int pointId = static_cast<std::int64_t>(i) * input.getNbPoints() / nbSamples;
+		if(is3D ? isPointFurtherThanMinDistNewPoint<3>(input, pointId, localPointCloudCells) :
+		   isPointFurtherThanMinDistNewPoint<2>(input, pointId, localPointCloudCells))
+		{
+			nbNewPoints++;
+		}
+	}
+	localPointCloudLock.unlock();
+
+	return static_cast<float>(nbNewPoints) / nbSamples;
+}
+
 void norlab_icp_mapper::Map::convertToSphericalCoordinates(const PM::DataPoints& points, PM::Matrix& radii, PM::Matrix& angles) const
 {
-	radii = points.features.topRows(points.getEuclideanDim()).colwise().norm();
+	if(is3D)
+	{
+		convertToSphericalCoordinates<3>(points, radii, angles);
+	}
+	else
+	{
+		convertToSphericalCoordinates<2>(points, radii, angles);
+	}
+}
+
+template<int EuclideanDim>
+void norlab_icp_mapper::Map::convertToSphericalCoordinates(const PM::DataPoints& points, PM::Matrix& radii, PM::Matrix& angles) const
+{
+	radii = PM::Matrix(1, points.getNbPoints());
 	angles = PM::Matrix(2, points.getNbPoints());
 
-	for(int i = 0; i < points.getNbPoints(); i++)
+	threadPool.parallelForBlocks(points.getNbPoints(), PARALLEL_BLOCK_SIZE, [&](const int& begin, const int& end)
 	{
-		angles(0, i) = 0;
-		if(is3D)
+		const int nbBlockPoints = end - begin;
+		radii.middleCols(begin, nbBlockPoints) = points.features.block(0, begin, EuclideanDim, nbBlockPoints).colwise().norm();
+		if(EuclideanDim == 3)
 		{
-			const float ratio = points.features(2, i) / radii(0, i);
-			angles(0, i) = asin(ratio);
+			angles.block(0, begin, 1, nbBlockPoints) =
+					(points.features.block(2, begin, 1, nbBlockPoints).array() / radii.middleCols(begin, nbBlockPoints).array()).asin().matrix();
 		}
-		angles(1, i) = atan2(points.features(1, i), points.features(0, i));
-	}
+		else
+		{
+			angles.block(0, begin, 1, nbBlockPoints).setZero();
+		}
+		for(int i = begin; i < end; i++)
+		{
+			angles(1, i) = std::atan2(points.features(1, i), points.features(0, i));
+		}
+	});
 }
 
 bool norlab_icp_mapper::Map::getNewLocalPointCloud(PM::DataPoints& localPointCloudOut)
+{
+	std::shared_ptr<const PM::DataPoints> localPointCloudSnapshot;
+	bool localPointCloudReturned = getNewLocalPointCloud(localPointCloudSnapshot);
+	if(localPointCloudReturned)
+	{
+		localPointCloudOut = *localPointCloudSnapshot;
+	}
+	return localPointCloudReturned;
+}
+
+bool norlab_icp_mapper::Map::getNewLocalPointCloud(std::shared_ptr<const PM::DataPoints>& localPointCloudOut)
 {
 	bool localPointCloudReturned = false;
 
-	localPointCloudLock.lock();
+	// snapshots are never modified, so sharing them is enough
+	lockLocalPointCloud();
 	if(newLocalPointCloudAvailable)
 	{
 		localPointCloudOut = localPointCloud;
@@ -710,50 +1518,342 @@ bool norlab_icp_mapper::Map::getNewLocalPointCloud(PM::DataPoints& localPointClo
 	return localPointCloudReturned;
 }
 
+norlab_icp_mapper::LocalPointCloudDelta norlab_icp_mapper::Map::getLocalPointCloudDelta(const std::uint64_t& version)
+{
+	lockLocalPointCloud();
+	std::lock_guard<std::mutex> lock(localPointCloudLock, std::adopt_lock);
+
+	LocalPointCloudDelta delta;
+	delta.version = localPointCloudVersion;
+	delta.isReset = version < oldestLocalPointCloudDeltaVersion || version > localPointCloudVersion;
+	if(!delta.isReset)
+	{
+		for(const auto& removedCell: removedLocalPointCloudCells)
+		{
+			if(removedCell.first > version)
+			{
+				delta.removedCellIds.push_back(removedCell.second);
+			}
+		}
+	}
+
+	for(const auto& cell: localPointCloudCells)
+	{
+		const PM::DataPoints& cellPoints = cell.second.points;
+		if(delta.isReset || cell.second.version > version)
+		{
+			// the cell was created or modified, so it is sent as a whole
+			if(!delta.isReset)
+			{
+				delta.removedCellIds.push_back(cell.first);
+			}
+			delta.addedCellIds.push_back(cell.first);
+			delta.addedPoints.push_back(cellPoints);
+			continue;
+		}
+
+		for(const auto& appendedPoints: cell.second.appendedPoints)
+		{
+			if(appendedPoints.first > version)
+			{
+				const int nbAddedPoints = cellPoints.getNbPoints() - appendedPoints.second;
+				PM::DataPoints addedPoints = cellPoints.createSimilarEmpty(nbAddedPoints);
+				addedPoints.features = cellPoints.features.rightCols(nbAddedPoints);
+				addedPoints.descriptors = cellPoints.descriptors.rightCols(nbAddedPoints);
+				addedPoints.times = cellPoints.times.rightCols(nbAddedPoints);
+				delta.addedCellIds.push_back(cell.first);
+				delta.addedPoints.push_back(addedPoints);
+				break;
+			}
+		}
+	}
+	return delta;
+}
+
+void norlab_icp_mapper::Map::recordLocalPointCloudCellRemoval(const CellId& cellId)
+{
+	removedLocalPointCloudCells.push_back(std::make_pair(localPointCloudVersion, cellId));
+	if(removedLocalPointCloudCells.size() > MAX_NB_TRACKED_CELL_REMOVALS)
+	{
+		// clients older than the forgotten removal have to start over
+		oldestLocalPointCloudDeltaVersion = removedLocalPointCloudCells.front().first;
+		removedLocalPointCloudCells.pop_front();
+	}
+}
+
 norlab_icp_mapper::Map::PM::DataPoints norlab_icp_mapper::Map::getGlobalPointCloud()
 {
-	localPointCloudLock.lock();
-	PM::DataPoints globalMap = localPointCloud;
-	std::unordered_set<std::string> currentLoadedCellIds = loadedCellIds;
+	lockLocalPointCloud();
+	std::shared_ptr<const PM::DataPoints> currentLocalPointCloud = localPointCloud;
+	std::unordered_set<CellId, CellIdHash> currentLoadedCellIds = loadedCellIds;
+	localPointCloudLock.unlock();
+
+	std::vector<PM::DataPoints> frozenCells;
+	if(frozenCellManager)
+	{
+		std::lock_guard<std::mutex> frozenCellGuard(frozenCellLock);
+		Profiler::Span cellRetrievalSpan(profiler, Profiler::CELL_RETRIEVAL);
+		frozenCells = frozenCellManager->retrieveCells(frozenCellManager->getAllCellIds());
+	}
+
+	// cells kept in memory are merged without being copied first, the other ones are retrieved concurrently
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	std::vector<const PM::DataPoints*> points = {currentLocalPointCloud.get()};
+	std::vector<CellId> cellIdsToRetrieve;
+	for(const auto& savedCellId: cellManager->getAllCellIds())
+	{
+		if(currentLoadedCellIds.find(savedCellId) == currentLoadedCellIds.end())
+		{
+			const PM::DataPoints* cellView = cellManager->viewCell(savedCellId);
+			if(cellView != nullptr)
+			{
+				points.push_back(cellView);
+			}
+			else
+			{
+				cellIdsToRetrieve.push_back(savedCellId);
+			}
+		}
+	}
+	Profiler::Span cellRetrievalSpan(profiler, Profiler::CELL_RETRIEVAL);
+	const std::vector<PM::DataPoints> retrievedCells = cellManager->retrieveCells(cellIdsToRetrieve);
+	for(const auto& retrievedCell: retrievedCells)
+	{
+		points.push_back(&retrievedCell);
+	}
+	for(const auto& frozenCell: frozenCells)
+	{
+		points.push_back(&frozenCell);
+	}
+	return DataPointsMerger::merge(points);
+}
+
+void norlab_icp_mapper::Map::visitGlobalPointCloud(const std::function<void(const CellId&, const PM::DataPoints&)>& visitor)
+{
+	lockLocalPointCloud();
+	std::vector<CellId> cellIds;
+	for(const auto& cell: localPointCloudCells)
+	{
+		cellIds.push_back(cell.first);
+	}
+	std::unordered_set<CellId, CellIdHash> currentLoadedCellIds = loadedCellIds;
 	localPointCloudLock.unlock();
 	cellManagerLock.lock();
-	std::vector<std::string> savedCellIds = cellManager->getAllCellIds();
+	for(const auto& savedCellId: cellManager->getAllCellIds())
+	{
+		if(currentLoadedCellIds.find(savedCellId) == currentLoadedCellIds.end())
+		{
+			cellIds.push_back(savedCellId);
+		}
+	}
 	cellManagerLock.unlock();
 
-	for(const auto& savedCellId: savedCellIds)
+	// only one cell is copied at a time and the locks are released while it is visited
+	for(const auto& cellId: cellIds)
 	{
-		if(currentLoadedCellIds.find(savedCellId) == currentLoadedCellIds.end())
+		PM::DataPoints cell;
+		cellTransferLock.lock();
+		lockLocalPointCloud();
+		auto localCell = localPointCloudCells.find(cellId);
+		const bool isCellLocal = localCell != localPointCloudCells.end();
+		if(isCellLocal)
+		{
+			cell = localCell->second.points;
+		}
+		localPointCloudLock.unlock();
+		if(!isCellLocal)
 		{
 			cellManagerLock.lock();
-			PM::DataPoints cell = cellManager->retrieveCell(savedCellId);
+			cell = cellManager->retrieveCell(cellId);
 			cellManagerLock.unlock();
-			globalMap.concatenate(cell);
+		}
+		cellTransferLock.unlock();
+
+		if(cell.getNbPoints() > 0)
+		{
+			visitor(cellId, cell);
+		}
+	}
+
+	// frozen cells are visited after the active ones, a cell id being visited twice when it is both active and frozen
+	if(frozenCellManager)
+	{
+		frozenCellLock.lock();
+		const std::vector<CellId> frozenCellIds = frozenCellManager->getAllCellIds();
+		frozenCellLock.unlock();
+		for(const auto& cellId: frozenCellIds)
+		{
+			frozenCellLock.lock();
+			const PM::DataPoints cell = frozenCellManager->retrieveCell(cellId);
+			frozenCellLock.unlock();
+			if(cell.getNbPoints() > 0)
+			{
+				visitor(cellId, cell);
+			}
 		}
 	}
-	return globalMap;
 }
 
-void norlab_icp_mapper::Map::setGlobalPointCloud(const PM::DataPoints& newLocalPointCloud)
+void norlab_icp_mapper::Map::saveGlobalPointCloud(const std::string& fileName)
 {
-	if(computeProbDynamic && !newLocalPointCloud.descriptorExists("normals"))
+	std::ofstream ofs(fileName, std::ios::binary);
+	if(!ofs)
+	{
+		throw std::runtime_error("unable to open " + fileName + ".");
+	}
+
+	// the vertex count is only known at the end, so it is written with a fixed width and patched afterwards
+	const int euclideanDim = is3D ? 3 : 2;
+	const int vertexCountWidth = 20;
+	std::streampos vertexCountPosition;
+	std::vector<std::pair<std::string, int>> descriptorRows;
+	const auto writeHeader = [&](const PM::DataPoints::Labels& descriptorLabels)
+	{
+		ofs << "ply\nformat binary_little_endian 1.0\nelement vertex ";
+		vertexCountPosition = ofs.tellp();
+		ofs << std::string(vertexCountWidth, '0') << "\n";
+		const char axes[3] = {'x', 'y', 'z'};
+		for(int i = 0; i < euclideanDim; i++)
+		{
+			ofs << "property float " << axes[i] << "\n";
+		}
+		for(const auto& descriptorLabel: descriptorLabels)
+		{
+			for(int i = 0; i < descriptorLabel.span; i++)
+			{
+				ofs << "property float " << descriptorLabel.text;
+				if(descriptorLabel.span > 1)
+				{
+					ofs << "_" << i;
+				}
+				ofs << "\n";
+				descriptorRows.push_back(std::make_pair(descriptorLabel.text, i));
+			}
+		}
+		ofs << "end_header\n";
+	};
+
+	std::uint64_t nbVertices = 0;
+	visitGlobalPointCloud([&](const CellId&, const PM::DataPoints& cell)
+	{
+		if(nbVertices == 0)
+		{
+			writeHeader(cell.descriptorLabels);
+		}
+
+		// columns of the matrix are the vertices, so it can be written as is, descriptors missing from a cell are written as zeros
+		PM::Matrix vertices = PM::Matrix::Zero(euclideanDim + descriptorRows.size(), cell.getNbPoints());
+		vertices.topRows(euclideanDim) = cell.features.topRows(euclideanDim);
+		for(int i = 0; i < descriptorRows.size(); i++)
+		{
+			if(cell.descriptorExists(descriptorRows[i].first))
+			{
+				vertices.row(euclideanDim + i) = cell.getDescriptorViewByName(descriptorRows[i].first).row(descriptorRows[i].second);
+			}
+		}
+		ofs.write(reinterpret_cast<const char*>(vertices.data()), vertices.size() * sizeof(float));
+		nbVertices += cell.getNbPoints();
+	});
+
+	if(nbVertices == 0)
+	{
+		writeHeader(PM::DataPoints::Labels());
+	}
+	else
+	{
+		std::string vertexCount = std::to_string(nbVertices);
+		ofs.seekp(vertexCountPosition);
+		ofs << std::string(vertexCountWidth - vertexCount.size(), '0') << vertexCount;
+	}
+	if(!ofs)
+	{
+		throw std::runtime_error("unable to write " + fileName + ".");
+	}
+}
+
+void norlab_icp_mapper::Map::setGlobalPointCloud(const PM::DataPoints& newGlobalPointCloud)
+{
+	if(computeProbDynamic && !newGlobalPointCloud.descriptorExists("normals"))
 	{
 		throw std::runtime_error("compute prob dynamic is set to true, but field normals does not exist for map points.");
 	}
 
-	localPointCloudLock.lock();
-	localPointCloud = newLocalPointCloud;
+	std::vector<CellId> newCellIds;
+	std::vector<PM::DataPoints> newCells;
+	partitionIntoCells(newGlobalPointCloud, newCellIds, newCells);
+	setGlobalPointCloud(newCellIds, std::move(newCells));
+}
 
-	icpMapLock.lock();
-	icp.setMap(localPointCloud);
-	icpMapLock.unlock();
+void norlab_icp_mapper::Map::setGlobalPointCloud(const std::vector<CellId>& newCellIds, std::vector<PM::DataPoints> newCells)
+{
+	for(const auto& cell: newCells)
+	{
+		if(computeProbDynamic && cell.getNbPoints() > 0 && !cell.descriptorExists("normals"))
+		{
+			throw std::runtime_error("compute prob dynamic is set to true, but field normals does not exist for map points.");
+		}
+	}
+
+	std::lock_guard<std::mutex> cellTransferGuard(cellTransferLock);
+	lockLocalPointCloud();
+	localPointCloudCells.clear();
+	loadedCellIds.clear();
+	neighborFrozenCells.clear();
+	localPointCloudVersion++;
+	removedLocalPointCloudCells.clear();
+	oldestLocalPointCloudDeltaVersion = localPointCloudVersion;
+
+	// the registration map is replaced when the first pose loads cells, it is left as is in the meantime since it cannot be empty
+	localPointCloud = std::make_shared<const PM::DataPoints>();
+	localPointCloudSize.store(0);
+	nbLocalPointCloudCells.store(0);
+	localPointCloudEmpty.store(true);
+	newLocalPointCloudAvailable = true;
 
-	localPointCloudEmpty.store(localPointCloud.getNbPoints() == 0);
+	// the new cells are handed to the cell manager as they are, only the ones around the first pose get loaded
+	cellManagerLock.lock();
+	cellManager->clearAllCells();
+	cellManager->saveCells(newCellIds, std::move(newCells));
+	cellManagerLock.unlock();
+	if(frozenCellManager)
+	{
+		std::lock_guard<std::mutex> frozenCellGuard(frozenCellLock);
+		frozenCellManager->clearAllCells();
+		frozenCellVersions.clear();
+	}
 
 	firstPoseUpdate.store(true);
 	localPointCloudLock.unlock();
 }
 
+bool norlab_icp_mapper::Map::isPoseInitialized() const
+{
+	return !firstPoseUpdate.load();
+}
+
 bool norlab_icp_mapper::Map::isLocalPointCloudEmpty() const
 {
 	return localPointCloudEmpty.load();
 }
+
+float norlab_icp_mapper::Map::getCellSize() const
+{
+	return cellSize;
+}
+
+norlab_icp_mapper::CellCacheStats norlab_icp_mapper::Map::getCellCacheStats() const
+{
+	if(cellCache == nullptr)
+	{
+		return CellCacheStats{0, 0, 0, 0};
+	}
+	return cellCache->getStats();
+}
+
+norlab_icp_mapper::MapStats norlab_icp_mapper::Map::getStats()
+{
+	updateListLock.lock();
+	const std::size_t updateListSize = updateList.size();
+	updateListLock.unlock();
+	return MapStats{updateListSize, localPointCloudSize.load(), nbLocalPointCloudCells.load(), nbLoadedBytes.load(), nbUnloadedBytes.load()};
+}
@@ -4,17 +4,54 @@
 #include <pointmatcher/PointMatcher.h>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <list>
+#include <deque>
+#include <functional>
 #include <unordered_set>
+#include <unordered_map>
 #include "CellManager.h"
+#include "CachedCellManager.h"
+#include "DoubleBufferedICP.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "VoxelHash.h"
 
 namespace norlab_icp_mapper
 {
+	// Changes of the local point cloud since a version. The points of the removed cells, or all the points when isReset is set, have to be dropped
+	// before the added points are inserted.
+	typedef struct LocalPointCloudDelta
+	{
+		std::uint64_t version;
+		bool isReset;
+		std::vector<CellId> removedCellIds;
+		std::vector<CellId> addedCellIds;
+		std::vector<PointMatcher<float>::DataPoints> addedPoints;
+	} LocalPointCloudDelta;
+
+	typedef struct MapStats
+	{
+		std::size_t updateListSize;
+		std::size_t localPointCloudSize;
+		std::size_t nbLocalPointCloudCells;
+		std::uint64_t nbLoadedBytes;
+		std::uint64_t nbUnloadedBytes;
+	} MapStats;
+
 	class Map
 	{
 	private:
 		typedef PointMatcher<float> PM;
 
+		enum UpdateType
+		{
+			UNLOAD,
+			LOAD,
+			FREEZE,
+			GATHER_FROZEN_CELLS
+		};
+
 		typedef struct Update
 		{
 			int startRow;
@@ -23,11 +60,40 @@ namespace norlab_icp_mapper
 			int endColumn;
 			int startAisle;
 			int endAisle;
-			bool load;
+			UpdateType type;
 		} Update;
 
-		const int BUFFER_SIZE = 2;
-		const float CELL_SIZE = 20.0;
+		typedef struct GridWindow
+		{
+			int startRow;
+			int endRow;
+			int startColumn;
+			int endColumn;
+			int startAisle;
+			int endAisle;
+		} GridWindow;
+
+		typedef struct Cell
+		{
+			PM::DataPoints points;
+			VoxelHash voxelHash;
+			std::uint64_t version;
+			std::vector<std::pair<std::uint64_t, int>> appendedPoints;
+		} Cell;
+
+		typedef struct FrozenCell
+		{
+			PM::DataPoints points;
+			std::uint64_t version;
+		} FrozenCell;
+
+		const float PREFETCH_HORIZON = 2.0;
+		const int MAX_NB_TRACKED_CELL_REMOVALS = 4096;
+		const int MAX_NB_TRACKED_CELL_APPENDS = 64;
+		const int NB_NEW_POINT_RATIO_SAMPLES = 1024;
+		const int PARALLEL_BLOCK_SIZE = 4096;
+		const int NB_FROZEN_CELLS_PER_BATCH = 64;
+		const std::string FROZEN_CELL_FOLDER_NAME = "frozen_cells";
 
 		float sensorMaxRange;
 		float minDistNewPoint;
@@ -41,20 +107,41 @@ namespace norlab_icp_mapper
 		bool is3D;
 		bool isOnline;
 		bool computeProbDynamic;
-		PM::ICPSequence& icp;
-		std::mutex& icpMapLock;
-		PM::DataPoints localPointCloud;
+		std::string beamSearchMethod;
+		float submapLength;
+		float cellSize;
+		int bufferSize;
+		float postFilterMargin;
+		bool isMapPersistent;
+		DoubleBufferedICP& icp;
+		Profiler& profiler;
+		ThreadPool& threadPool;
+		std::shared_ptr<const PM::DataPoints> localPointCloud;
+		std::uint64_t localPointCloudVersion;
+		std::uint64_t oldestLocalPointCloudDeltaVersion;
+		std::deque<std::pair<std::uint64_t, CellId>> removedLocalPointCloudCells;
+		std::unordered_map<CellId, Cell, CellIdHash> localPointCloudCells;
 		std::mutex localPointCloudLock;
+		std::atomic<std::size_t> localPointCloudSize;
+		std::atomic<std::size_t> nbLocalPointCloudCells;
+		std::atomic<std::uint64_t> nbLoadedBytes;
+		std::atomic<std::uint64_t> nbUnloadedBytes;
 		std::unique_ptr<CellManager> cellManager;
+		CachedCellManager* cellCache;
 		std::mutex cellManagerLock;
-		std::unordered_set<std::string> loadedCellIds;
+		std::mutex cellTransferLock;
+		std::unordered_set<CellId, CellIdHash> loadedCellIds;
+		std::unique_ptr<CellManager> frozenCellManager;
+		std::string frozenCellFolder;
+		std::unordered_map<CellId, std::uint64_t, CellIdHash> frozenCellVersions;
+		std::mutex frozenCellLock;
+		PM::Vector activeSubmapOrigin;
+		GridWindow neighborFrozenWindow;
+		std::unordered_map<CellId, FrozenCell, CellIdHash> neighborFrozenCells;
 		std::shared_ptr<PM::Transformation> transformation;
-		int inferiorRowLastUpdateIndex;
-		int superiorRowLastUpdateIndex;
-		int inferiorColumnLastUpdateIndex;
-		int superiorColumnLastUpdateIndex;
-		int inferiorAisleLastUpdateIndex;
-		int superiorAisleLastUpdateIndex;
+		PM::DataPointsFilters clonedPostFilters;
+		std::vector<PM::DataPointsFilters> postFilterClones;
+		GridWindow loadedWindow;
 		bool newLocalPointCloudAvailable;
 		std::atomic_bool localPointCloudEmpty;
 		std::atomic_bool firstPoseUpdate;
@@ -62,37 +149,70 @@ namespace norlab_icp_mapper
 		std::thread updateThread;
 		std::list<Update> updateList;
 		std::mutex updateListLock;
+		std::condition_variable updateListCondition;
 
 		void updateThreadFunction();
 		void applyUpdate(const Update& update);
 		void loadCells(int startRow, int endRow, int startColumn, int endColumn, int startAisle, int endAisle);
-		float toInferiorWorldCoordinate(const int& gridCoordinate) const;
-		float toSuperiorWorldCoordinate(const int& gridCoordinate) const;
 		void unloadCells(int startRow, int endRow, int startColumn, int endColumn, int startAisle, int endAisle);
-		int toGridCoordinate(const float& worldCoordinate) const;
+		void partitionIntoCells(const PM::DataPoints& points, std::vector<CellId>& cellIds, std::vector<PM::DataPoints>& cells) const;
+		void addToLocalPointCloudCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>& cells);
+		void rebuildLocalPointCloud();
+		void lockLocalPointCloud();
+		void recordLocalPointCloudCellRemoval(const CellId& cellId);
+		void clonePostFilters(const PM::DataPointsFilters& postFilters, const int& nbClones);
+		PM::DataPoints applyPostFilters(const CellId& cellId, const PM::TransformationParameters& pose, PM::DataPointsFilters& postFilters) const;
+		PM::DataPoints gatherPoints(const PM::DataPoints& points, const std::vector<int>& pointIds, const int& begin, const int& end) const;
 		int getMinGridCoordinate() const;
 		int getMaxGridCoordinate() const;
 		int toInferiorGridCoordinate(const float& worldCoordinate, const float& range) const;
 		int toSuperiorGridCoordinate(const float& worldCoordinate, const float& range) const;
-		void scheduleUpdate(const Update& update);
-		PM::DataPoints retrievePointsFurtherThanMinDistNewPoint(const PM::DataPoints& input, const PM::DataPoints& currentLocalPointCloud,
+		GridWindow toLoadedWindow(const PM::TransformationParameters& pose) const;
+		std::vector<GridWindow> subtractGridWindows(const GridWindow& window, const GridWindow& subtractedWindow) const;
+		void scheduleUpdates(const std::vector<Update>& updates);
+		bool isCellInGridWindow(const CellId& cellId, const GridWindow& window) const;
+		void updateSubmaps(const PM::TransformationParameters& pose);
+		void freezeActiveSubmap();
+		void saveFrozenCells(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints>& cells, const std::uint64_t& version);
+		void gatherNeighborFrozenCells(const GridWindow& window);
+		void prefetchCells(const PM::TransformationParameters& pose, const PM::Vector& velocity);
+		PM::DataPoints retrievePointsFurtherThanMinDistNewPoint(const PM::DataPoints& input,
+																const std::unordered_map<CellId, Cell, CellIdHash>& cells,
 																const PM::TransformationParameters& pose) const;
-		void computeProbabilityOfPointsBeingDynamic(const PM::DataPoints& input, PM::DataPoints& currentLocalPointCloud,
-													const PM::TransformationParameters& pose) const;
+		template<int EuclideanDim>
+		PM::DataPoints retrievePointsFurtherThanMinDistNewPoint(const PM::DataPoints& input, const std::unordered_map<CellId, Cell, CellIdHash>& cells) const;
+		template<int EuclideanDim>
+		bool isPointFurtherThanMinDistNewPoint(const PM::DataPoints& input, const int& pointId, const std::unordered_map<CellId, Cell, CellIdHash>& cells) const;
+		void computeProbabilityOfPointsBeingDynamic(const PM::DataPoints& input, std::unordered_map<CellId, Cell, CellIdHash>& cells,
+													const PM::TransformationParameters& pose, const std::uint64_t& version) const;
+		void convertToSphericalCoordinates(const PM::DataPoints& points, PM::Matrix& radii, PM::Matrix& angles) const;
+		template<int EuclideanDim>
 		void convertToSphericalCoordinates(const PM::DataPoints& points, PM::Matrix& radii, PM::Matrix& angles) const;
 
 	public:
 		Map(const float& minDistNewPoint, const float& sensorMaxRange, const float& priorDynamic, const float& thresholdDynamic, const float& beamHalfAngle,
 			const float& epsilonA, const float& epsilonD, const float& alpha, const float& beta, const bool& is3D, const bool& isOnline,
-			const bool& computeProbDynamic, const bool& saveCellsOnHardDrive, PM::ICPSequence& icp, std::mutex& icpMapLock);
+			const bool& computeProbDynamic, const std::string& beamSearchMethod, const bool& saveCellsOnHardDrive, const std::string& hardDriveCellStore,
+			const std::string& hardDriveCellFolder, const float& hardDriveCellCacheSize, const float& submapLength, const float& cellSize,
+			const int& bufferSize, const float& postFilterMargin, Profiler& profiler, ThreadPool& threadPool, DoubleBufferedICP& icp);
 		~Map();
-		void updatePose(const PM::TransformationParameters& pose);
+		void updatePose(const PM::TransformationParameters& pose, const PM::Vector& velocity);
 		PM::DataPoints getLocalPointCloud();
+		float estimateNewPointRatio(const PM::DataPoints& input);
 		void updateLocalPointCloud(PM::DataPoints input, PM::TransformationParameters pose, PM::DataPointsFilters postFilters);
 		bool getNewLocalPointCloud(PM::DataPoints& localPointCloudOut);
+		bool getNewLocalPointCloud(std::shared_ptr<const PM::DataPoints>& localPointCloudOut);
+		LocalPointCloudDelta getLocalPointCloudDelta(const std::uint64_t& version);
 		PM::DataPoints getGlobalPointCloud();
-		void setGlobalPointCloud(const PM::DataPoints& newLocalPointCloud);
+		void visitGlobalPointCloud(const std::function<void(const CellId&, const PM::DataPoints&)>& visitor);
+		void saveGlobalPointCloud(const std::string& fileName);
+		void setGlobalPointCloud(const PM::DataPoints& newGlobalPointCloud);
+		void setGlobalPointCloud(const std::vector<CellId>& newCellIds, std::vector<PM::DataPoints> newCells);
+		bool isPoseInitialized() const;
 		bool isLocalPointCloudEmpty() const;
+		float getCellSize() const;
+		CellCacheStats getCellCacheStats() const;
+		MapStats getStats();
 	};
 }
 
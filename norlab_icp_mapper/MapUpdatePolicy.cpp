@@ -0,0 +1,152 @@
+#include "MapUpdatePolicy.h"
+#include <sstream>
+#include <stdexcept>
+
+std::unique_ptr<norlab_icp_mapper::MapUpdatePolicy> norlab_icp_mapper::MapUpdatePolicy::create(const std::string& condition, const float& overlap,
+																							   const float& delay, const float& distance,
+																							   const float& rotation, const float& newPointRatio)
+{
+	const std::runtime_error invalidConditionError("invalid map update condition: " + condition +
+												   ", expected overlap, delay, distance, rotation or newPoints, combined with & and |.");
+	if(condition.empty() || condition.back() == '|' || condition.back() == '&')
+	{
+		throw invalidConditionError;
+	}
+
+	std::vector<std::unique_ptr<MapUpdatePolicy>> anyPolicies;
+	std::istringstream conditionStream(condition);
+	std::string conjunction;
+	while(std::getline(conditionStream, conjunction, '|'))
+	{
+		std::vector<std::unique_ptr<MapUpdatePolicy>> allPolicies;
+		std::istringstream conjunctionStream(conjunction);
+		std::string criterion;
+		while(std::getline(conjunctionStream, criterion, '&'))
+		{
+			if(criterion == "overlap")
+			{
+				allPolicies.emplace_back(new OverlapMapUpdatePolicy(overlap));
+			}
+			else if(criterion == "delay")
+			{
+				allPolicies.emplace_back(new DelayMapUpdatePolicy(delay));
+			}
+			else if(criterion == "distance")
+			{
+				allPolicies.emplace_back(new DistanceMapUpdatePolicy(distance));
+			}
+			else if(criterion == "rotation")
+			{
+				allPolicies.emplace_back(new RotationMapUpdatePolicy(rotation));
+			}
+			else if(criterion == "newPoints")
+			{
+				allPolicies.emplace_back(new NewPointsMapUpdatePolicy(newPointRatio));
+			}
+			else
+			{
+				throw invalidConditionError;
+			}
+		}
+		if(allPolicies.empty())
+		{
+			throw invalidConditionError;
+		}
+		anyPolicies.emplace_back(allPolicies.size() == 1 ? std::move(allPolicies.front()) :
+								 std::unique_ptr<MapUpdatePolicy>(new AllMapUpdatePolicy(std::move(allPolicies))));
+	}
+	return anyPolicies.size() == 1 ? std::move(anyPolicies.front()) : std::unique_ptr<MapUpdatePolicy>(new AnyMapUpdatePolicy(std::move(anyPolicies)));
+}
+
+norlab_icp_mapper::OverlapMapUpdatePolicy::OverlapMapUpdatePolicy(const float& overlap):
+		overlap(overlap)
+{
+}
+
+bool norlab_icp_mapper::OverlapMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	return state.currentOverlap < overlap;
+}
+
+norlab_icp_mapper::DelayMapUpdatePolicy::DelayMapUpdatePolicy(const float& delay):
+		delay(delay)
+{
+}
+
+bool norlab_icp_mapper::DelayMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	return (state.currentTime - state.lastUpdateTime) > std::chrono::duration<float>(delay);
+}
+
+norlab_icp_mapper::DistanceMapUpdatePolicy::DistanceMapUpdatePolicy(const float& distance):
+		distance(distance)
+{
+}
+
+bool norlab_icp_mapper::DistanceMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	const int euclideanDim = state.currentPose.rows() - 1;
+	PointMatcher<float>::Vector lastLocation = state.lastUpdatePose.topRightCorner(euclideanDim, 1);
+	PointMatcher<float>::Vector currentLocation = state.currentPose.topRightCorner(euclideanDim, 1);
+	return (currentLocation - lastLocation).norm() > distance;
+}
+
+norlab_icp_mapper::RotationMapUpdatePolicy::RotationMapUpdatePolicy(const float& rotation):
+		rotation(rotation)
+{
+}
+
+bool norlab_icp_mapper::RotationMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	// the angle of a rotation matrix follows from its trace, which is 1 + 2cos(angle) in 3D and 2cos(angle) in 2D
+	const int euclideanDim = state.currentPose.rows() - 1;
+	const PointMatcher<float>::Matrix relativeRotation =
+			state.lastUpdatePose.topLeftCorner(euclideanDim, euclideanDim).transpose() * state.currentPose.topLeftCorner(euclideanDim, euclideanDim);
+	const float cosAngle = euclideanDim == 3 ? (relativeRotation.trace() - 1.0f) / 2.0f : relativeRotation.trace() / 2.0f;
+	return std::acos(std::max(-1.0f, std::min(1.0f, cosAngle))) > rotation;
+}
+
+norlab_icp_mapper::NewPointsMapUpdatePolicy::NewPointsMapUpdatePolicy(const float& newPointRatio):
+		newPointRatio(newPointRatio)
+{
+}
+
+bool norlab_icp_mapper::NewPointsMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	return state.estimateNewPointRatio() > newPointRatio;
+}
+
+norlab_icp_mapper::AllMapUpdatePolicy::AllMapUpdatePolicy(std::vector<std::unique_ptr<MapUpdatePolicy>> policies):
+		policies(std::move(policies))
+{
+}
+
+bool norlab_icp_mapper::AllMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	// criteria are checked in order, so the expensive ones should come last
+	for(const auto& policy: policies)
+	{
+		if(!policy->shouldUpdateMap(state))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+norlab_icp_mapper::AnyMapUpdatePolicy::AnyMapUpdatePolicy(std::vector<std::unique_ptr<MapUpdatePolicy>> policies):
+		policies(std::move(policies))
+{
+}
+
+bool norlab_icp_mapper::AnyMapUpdatePolicy::shouldUpdateMap(const MapUpdateState& state) const
+{
+	for(const auto& policy: policies)
+	{
+		if(policy->shouldUpdateMap(state))
+		{
+			return true;
+		}
+	}
+	return false;
+}
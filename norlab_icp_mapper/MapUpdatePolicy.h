@@ -0,0 +1,108 @@
+#ifndef MAP_UPDATE_POLICY_H
+#define MAP_UPDATE_POLICY_H
+
+#include <pointmatcher/PointMatcher.h>
+#include <chrono>
+#include <functional>
+#include <memory>
+
+namespace norlab_icp_mapper
+{
+	// State of the mapper when an input has just been registered. The ratio of new points is only estimated when a policy asks for it.
+	typedef struct MapUpdateState
+	{
+		std::chrono::time_point<std::chrono::steady_clock> currentTime;
+		PointMatcher<float>::TransformationParameters currentPose;
+		float currentOverlap;
+		std::chrono::time_point<std::chrono::steady_clock> lastUpdateTime;
+		PointMatcher<float>::TransformationParameters lastUpdatePose;
+		std::function<float()> estimateNewPointRatio;
+	} MapUpdateState;
+
+	// Criterion deciding whether the map is updated with the current input.
+	class MapUpdatePolicy
+	{
+	public:
+		virtual ~MapUpdatePolicy() = default;
+		virtual bool shouldUpdateMap(const MapUpdateState& state) const = 0;
+
+		// Conditions are made of the criteria overlap, delay, distance, rotation and newPoints, combined with & and |, & taking precedence over |.
+		static std::unique_ptr<MapUpdatePolicy> create(const std::string& condition, const float& overlap, const float& delay, const float& distance,
+													   const float& rotation, const float& newPointRatio);
+	};
+
+	class OverlapMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		const float overlap;
+
+	public:
+		OverlapMapUpdatePolicy(const float& overlap);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+
+	// Combined with another criterion, caps the update rate.
+	class DelayMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		const float delay;
+
+	public:
+		DelayMapUpdatePolicy(const float& delay);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+
+	class DistanceMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		const float distance;
+
+	public:
+		DistanceMapUpdatePolicy(const float& distance);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+
+	// Rotation is in radians.
+	class RotationMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		const float rotation;
+
+	public:
+		RotationMapUpdatePolicy(const float& rotation);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+
+	// Skips the updates that would add too few points, the ratio being the one of input points further than minDistNewPoint from the map.
+	class NewPointsMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		const float newPointRatio;
+
+	public:
+		NewPointsMapUpdatePolicy(const float& newPointRatio);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+
+	class AllMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		std::vector<std::unique_ptr<MapUpdatePolicy>> policies;
+
+	public:
+		AllMapUpdatePolicy(std::vector<std::unique_ptr<MapUpdatePolicy>> policies);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+
+	class AnyMapUpdatePolicy : public MapUpdatePolicy
+	{
+	private:
+		std::vector<std::unique_ptr<MapUpdatePolicy>> policies;
+
+	public:
+		AnyMapUpdatePolicy(std::vector<std::unique_ptr<MapUpdatePolicy>> policies);
+		bool shouldUpdateMap(const MapUpdateState& state) const override;
+	};
+}
+
+#endif
@@ -0,0 +1,166 @@
+#include "MappedSegmentCellManager.h"
+#include "CellSerializer.h"
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+namespace
+{
+	// stream buffer over a memory area, used to serialize cells directly into the mapped segments
+	class MemoryBuffer : public std::streambuf
+	{
+	public:
+		MemoryBuffer(char* data, const std::size_t& size)
+		{
+			setg(data, data, data + size);
+			setp(data, data + size);
+		}
+	};
+}
+
+norlab_icp_mapper::MappedSegmentCellManager::MappedSegmentCellManager(const std::string& cellFolder, ThreadPool& threadPool):
+		cellFolder(cellFolder),
+		threadPool(threadPool)
+{
+}
+
+norlab_icp_mapper::MappedSegmentCellManager::~MappedSegmentCellManager()
+{
+	clearAllCells();
+}
+
+std::vector<norlab_icp_mapper::CellId> norlab_icp_mapper::MappedSegmentCellManager::getAllCellIds() const
+{
+	std::vector<CellId> cellIds;
+	for(const auto& cellLocation: cellLocations)
+	{
+		cellIds.push_back(cellLocation.first);
+	}
+	return cellIds;
+}
+
+void norlab_icp_mapper::MappedSegmentCellManager::saveCell(const CellId& cellId, const PM::DataPoints& cell)
+{
+	const std::size_t cellSize = CellSerializer::getSerializedSize(cell);
+	if(segments.empty() || segments.back().size + cellSize > segments.back().capacity)
+	{
+		if(!segments.empty() && segments.back().liveSize == 0)
+		{
+			closeSegment(segments.size() - 1);
+		}
+		openSegment(std::max(SEGMENT_CAPACITY, cellSize));
+	}
+
+	Segment& segment = segments.back();
+	MemoryBuffer buffer(segment.data + segment.size, cellSize);
+	std::ostream os(&buffer);
+	CellSerializer::write(os, cell);
+	if(!os.good())
+	{
+		// the space of the partially written cell is reused by the next one
+		throw std::runtime_error("unable to write cell in cell segment " + segment.fileName + ".");
+	}
+
+	// the previous version of the cell becomes garbage
+	auto oldCellLocation = cellLocations.find(cellId);
+	if(oldCellLocation != cellLocations.end())
+	{
+		Segment& oldSegment = segments[oldCellLocation->second.segmentId];
+		oldSegment.liveSize -= oldCellLocation->second.size;
+		if(oldSegment.liveSize == 0 && oldCellLocation->second.segmentId != segments.size() - 1)
+		{
+			closeSegment(oldCellLocation->second.segmentId);
+		}
+	}
+
+	cellLocations[cellId] = CellLocation{static_cast<int>(segments.size() - 1), segment.size, cellSize};
+	segment.size += cellSize;
+	segment.liveSize += cellSize;
+}
+
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::MappedSegmentCellManager::retrieveCell(const CellId& cellId) const
+{
+	PM::DataPoints cell;
+	auto cellLocation = cellLocations.find(cellId);
+	if(cellLocation != cellLocations.end())
+	{
+		MemoryBuffer buffer(segments[cellLocation->second.segmentId].data + cellLocation->second.offset, cellLocation->second.size);
+		std::istream is(&buffer);
+		cell = CellSerializer::read(is);
+	}
+	return cell;
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::MappedSegmentCellManager::retrieveCells(const std::vector<CellId>& cellIds) const
+{
+	// reading cells does not modify the cell manager, so they are read and decoded concurrently
+	std::vector<PM::DataPoints> cells(cellIds.size());
+	threadPool.parallelFor(cellIds.size(), [&](const int& i)
+	{
+		cells[i] = retrieveCell(cellIds[i]);
+	});
+	return cells;
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::MappedSegmentCellManager::takeCells(const std::vector<CellId>& cellIds)
+{
+	return retrieveCells(cellIds);
+}
+
+void norlab_icp_mapper::MappedSegmentCellManager::clearAllCells()
+{
+	for(int i = 0; i < segments.size(); i++)
+	{
+		closeSegment(i);
+	}
+	segments.clear();
+	cellLocations.clear();
+}
+
+void norlab_icp_mapper::MappedSegmentCellManager::openSegment(const std::size_t& capacity)
+{
+	Segment segment;
+	segment.fileName = cellFolder + "/" + SEGMENT_FILE_NAME_PREFIX + std::to_string(segments.size()) + SEGMENT_FILE_NAME_SUFFIX;
+	segment.fileDescriptor = open(segment.fileName.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(segment.fileDescriptor < 0)
+	{
+		throw std::runtime_error("unable to create cell segment " + segment.fileName + ": " + std::strerror(errno));
+	}
+
+	// the disk space is allocated upfront, since writing to a sparse mapping on a full disk raises SIGBUS instead of returning an error
+	const int allocationError = posix_fallocate(segment.fileDescriptor, 0, capacity);
+	if(allocationError != 0)
+	{
+		close(segment.fileDescriptor);
+		std::remove(segment.fileName.c_str());
+		throw std::runtime_error("unable to allocate cell segment " + segment.fileName + ": " + std::strerror(allocationError));
+	}
+	void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segment.fileDescriptor, 0);
+	if(data == MAP_FAILED)
+	{
+		close(segment.fileDescriptor);
+		std::remove(segment.fileName.c_str());
+		throw std::runtime_error("unable to map cell segment " + segment.fileName + ": " + std::strerror(errno));
+	}
+
+	segment.data = static_cast<char*>(data);
+	segment.capacity = capacity;
+	segment.size = 0;
+	segment.liveSize = 0;
+	segments.push_back(segment);
+}
+
+void norlab_icp_mapper::MappedSegmentCellManager::closeSegment(const int& segmentId)
+{
+	Segment& segment = segments[segmentId];
+	if(segment.data != nullptr)
+	{
+		munmap(segment.data, segment.capacity);
+		close(segment.fileDescriptor);
+		std::remove(segment.fileName.c_str());
+		segment.data = nullptr;
+	}
+}
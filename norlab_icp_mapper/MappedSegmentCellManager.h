@@ -0,0 +1,58 @@
+#ifndef MAPPED_SEGMENT_CELL_MANAGER_H
+#define MAPPED_SEGMENT_CELL_MANAGER_H
+
+#include "CellManager.h"
+#include "ThreadPool.h"
+#include <unordered_map>
+
+namespace norlab_icp_mapper
+{
+	// Cell manager appending cells to a few large memory-mapped segment files. Segments whose cells were all overwritten are deleted.
+	// Cells are decoded from the mapping every time they are retrieved, since the points of a cell cannot be viewed in place, so viewCell keeps
+	// the default implementation.
+	class MappedSegmentCellManager : public CellManager
+	{
+	private:
+		typedef struct Segment
+		{
+			std::string fileName;
+			int fileDescriptor;
+			char* data;
+			std::size_t capacity;
+			std::size_t size;
+			std::size_t liveSize;
+		} Segment;
+
+		typedef struct CellLocation
+		{
+			int segmentId;
+			std::size_t offset;
+			std::size_t size;
+		} CellLocation;
+
+		const std::string SEGMENT_FILE_NAME_PREFIX = "cell_segment_";
+		const std::string SEGMENT_FILE_NAME_SUFFIX = ".seg";
+		const std::size_t SEGMENT_CAPACITY = 256 * 1024 * 1024;
+		std::string cellFolder;
+		std::vector<Segment> segments;
+		std::unordered_map<CellId, CellLocation, CellIdHash> cellLocations;
+		ThreadPool& threadPool;
+
+		void openSegment(const std::size_t& capacity);
+		void closeSegment(const int& segmentId);
+
+	public:
+		using CellManager::saveCell;
+
+		MappedSegmentCellManager(const std::string& cellFolder, ThreadPool& threadPool);
+		~MappedSegmentCellManager() override;
+		std::vector<CellId> getAllCellIds() const override;
+		void saveCell(const CellId& cellId, const PM::DataPoints& cell) override;
+		PM::DataPoints retrieveCell(const CellId& cellId) const override;
+		void clearAllCells() override;
+		std::vector<PM::DataPoints> retrieveCells(const std::vector<CellId>& cellIds) const override;
+		std::vector<PM::DataPoints> takeCells(const std::vector<CellId>& cellIds) override;
+	};
+}
+
+#endif
@@ -7,18 +7,28 @@ norlab_icp_mapper::Mapper::Mapper(const std::string& inputFiltersConfigFilePath,
 								  const float& mapUpdateDelay, const float& mapUpdateDistance, const float& minDistNewPoint, const float& sensorMaxRange,
 								  const float& priorDynamic, const float& thresholdDynamic, const float& beamHalfAngle, const float& epsilonA,
 								  const float& epsilonD, const float& alpha, const float& beta, const bool& is3D, const bool& isOnline,
-								  const bool& computeProbDynamic, const bool& isMapping, const bool& saveMapCellsOnHardDrive):
-		mapUpdateCondition(mapUpdateCondition),
-		mapUpdateOverlap(mapUpdateOverlap),
-		mapUpdateDelay(mapUpdateDelay),
-		mapUpdateDistance(mapUpdateDistance),
+								  const bool& computeProbDynamic, const bool& isMapping, const bool& saveMapCellsOnHardDrive,
+								  const bool& incrementalReference, const std::string& beamSearchMethod, const std::string& hardDriveCellStore,
+								  const std::string& hardDriveCellFolder, const float& hardDriveCellCacheSize, const int& inputQueueSize,
+								  const std::string& inputQueuePolicy, const float& mapUpdateRotation, const float& mapUpdateNewPointRatio,
+								  const float& submapLength, const float& cellSize, const int& bufferSize, const int& nbThreads,
+								  const float& postFilterMargin):
+		threadPool(nbThreads),
+		icp(profiler),
+		mapUpdatePolicy(MapUpdatePolicy::create(mapUpdateCondition, mapUpdateOverlap, mapUpdateDelay, mapUpdateDistance, mapUpdateRotation,
+												mapUpdateNewPointRatio)),
 		is3D(is3D),
 		isOnline(isOnline),
+		incrementalReference(incrementalReference),
 		isMapping(isMapping),
 		map(minDistNewPoint, sensorMaxRange, priorDynamic, thresholdDynamic, beamHalfAngle, epsilonA, epsilonD, alpha, beta, is3D,
-			isOnline, computeProbDynamic, saveMapCellsOnHardDrive, icp, icpMapLock),
+			isOnline, computeProbDynamic, beamSearchMethod, saveMapCellsOnHardDrive, hardDriveCellStore, hardDriveCellFolder,
+			hardDriveCellCacheSize, submapLength, cellSize, bufferSize, postFilterMargin, profiler, threadPool, icp),
+		publishedPose(std::make_shared<const PM::TransformationParameters>()),
 		trajectory(is3D ? 3 : 2),
-		transformation(PM::get().TransformationRegistrar.create("RigidTransformation"))
+		transformation(PM::get().TransformationRegistrar.create("RigidTransformation")),
+		inputsToFilter(inputQueueSize, inputQueuePolicy, std::bind(&Mapper::dropInput, this, std::placeholders::_1)),
+		inputsToRegister(inputQueueSize, inputQueuePolicy, std::bind(&Mapper::dropInput, this, std::placeholders::_1))
 {
 	loadYamlConfig(inputFiltersConfigFilePath, icpConfigFilePath, mapPostFiltersConfigFilePath);
 
@@ -29,6 +39,21 @@ norlab_icp_mapper::Mapper::Mapper(const std::string& inputFiltersConfigFilePath,
 	radiusFilter = PM::get().DataPointsFilterRegistrar.create("DistanceLimitDataPointsFilter", radiusFilterParams);
 }
 
+norlab_icp_mapper::Mapper::~Mapper()
+{
+	// inputs already submitted are still processed
+	inputsToFilter.close();
+	if(filteringThread.joinable())
+	{
+		filteringThread.join();
+	}
+	inputsToRegister.close();
+	if(registrationThread.joinable())
+	{
+		registrationThread.join();
+	}
+}
+
 void norlab_icp_mapper::Mapper::loadYamlConfig(const std::string& inputFiltersConfigFilePath, const std::string& icpConfigFilePath,
 											   const std::string& mapPostFiltersConfigFilePath)
 {
@@ -43,6 +68,11 @@ void norlab_icp_mapper::Mapper::loadYamlConfig(const std::string& inputFiltersCo
 		icp.setDefault();
 	}
 
+	if(incrementalReference)
+	{
+		icp.useCellMatcher(map.getCellSize());
+	}
+
 	if(!inputFiltersConfigFilePath.empty())
 	{
 		std::ifstream ifs(inputFiltersConfigFilePath.c_str());
@@ -62,48 +92,153 @@ void norlab_icp_mapper::Mapper::processInput(const PM::DataPoints& inputInSensor
 											 const std::chrono::time_point<std::chrono::steady_clock>& timeStamp,
 											 PM::DataPoints& filteredInputInSensorFrame)
 {
-	filteredInputInSensorFrame = radiusFilter->filter(inputInSensorFrame);
+	filteredInputInSensorFrame = filterInput(inputInSensorFrame);
+	registerInput(filteredInputInSensorFrame, estimatedPose, timeStamp);
+}
+
+std::future<norlab_icp_mapper::ProcessedInput> norlab_icp_mapper::Mapper::submitInput(const PM::DataPoints& inputInSensorFrame,
+																					 const PM::TransformationParameters& estimatedPose,
+																					 const std::chrono::time_point<std::chrono::steady_clock>& timeStamp)
+{
+	std::shared_ptr<std::promise<ProcessedInput>> result = std::make_shared<std::promise<ProcessedInput>>();
+	std::future<ProcessedInput> futureResult = result->get_future();
+	startPipeline();
+	inputsToFilter.push(PendingInput{inputInSensorFrame, estimatedPose, timeStamp, result});
+	return futureResult;
+}
+
+void norlab_icp_mapper::Mapper::startPipeline()
+{
+	// the pipeline threads are only started once inputs are submitted, so that users of processInput keep the original number of threads
+	std::call_once(pipelineStartFlag, [this]
+	{
+		filteringThread = std::thread(&Mapper::filteringThreadFunction, this);
+		registrationThread = std::thread(&Mapper::registrationThreadFunction, this);
+	});
+}
+
+void norlab_icp_mapper::Mapper::filteringThreadFunction()
+{
+	// the input of the next scan is filtered while the previous one is registered
+	PendingInput pendingInput;
+	while(inputsToFilter.pop(pendingInput))
+	{
+		try
+		{
+			pendingInput.inputInSensorFrame = filterInput(pendingInput.inputInSensorFrame);
+		}
+		catch(...)
+		{
+			pendingInput.result->set_exception(std::current_exception());
+			continue;
+		}
+		inputsToRegister.push(std::move(pendingInput));
+	}
+}
+
+void norlab_icp_mapper::Mapper::registrationThreadFunction()
+{
+	PendingInput pendingInput;
+	while(inputsToRegister.pop(pendingInput))
+	{
+		try
+		{
+			PM::TransformationParameters correctedPose = registerInput(pendingInput.inputInSensorFrame, pendingInput.estimatedPose, pendingInput.timeStamp);
+			pendingInput.result->set_value(ProcessedInput{correctedPose, pendingInput.inputInSensorFrame});
+		}
+		catch(...)
+		{
+			pendingInput.result->set_exception(std::current_exception());
+		}
+	}
+}
+
+void norlab_icp_mapper::Mapper::dropInput(PendingInput& input)
+{
+	input.result->set_exception(std::make_exception_ptr(std::runtime_error("input dropped because the input queue is full.")));
+}
+
+norlab_icp_mapper::Mapper::PM::DataPoints norlab_icp_mapper::Mapper::filterInput(const PM::DataPoints& inputInSensorFrame)
+{
+	PM::DataPoints filteredInputInSensorFrame;
+	{
+		Profiler::Span radiusFilterSpan(profiler, Profiler::RADIUS_FILTER);
+		filteredInputInSensorFrame = radiusFilter->filter(inputInSensorFrame);
+	}
+	Profiler::Span inputFiltersSpan(profiler, Profiler::INPUT_FILTERS);
 	inputFilters.apply(filteredInputInSensorFrame);
+	return filteredInputInSensorFrame;
+}
+
+norlab_icp_mapper::Mapper::PM::TransformationParameters norlab_icp_mapper::Mapper::registerInput(const PM::DataPoints& filteredInputInSensorFrame,
+																								 const PM::TransformationParameters& estimatedPose,
+																								 const std::chrono::time_point<std::chrono::steady_clock>& timeStamp)
+{
 	PM::DataPoints input = transformation->compute(filteredInputInSensorFrame, estimatedPose);
 
+	int euclideanDim = is3D ? 3 : 2;
+
+	// after a new map is set, only the cells around the first pose are loaded, so they have to be before registering against them
+	if(!map.isPoseInitialized())
+	{
+		map.updatePose(estimatedPose, PM::Vector::Zero(euclideanDim));
+	}
+
 	PM::TransformationParameters correctedPose;
 	if(map.isLocalPointCloudEmpty())
 	{
 		correctedPose = estimatedPose;
 
-		map.updatePose(correctedPose);
+		map.updatePose(correctedPose, PM::Vector::Zero(euclideanDim));
 
 		updateMap(input, correctedPose, timeStamp);
 	}
 	else
 	{
+		float overlap;
 		PM::TransformationParameters correction;
 		{
-			std::lock_guard<std::mutex> icpMapLockGuard(icpMapLock);
-			correction = icp(input);
+			Profiler::Span icpSpan(profiler, Profiler::ICP);
+			correction = icp.compute(input, overlap);
 		}
 		correctedPose = correction * estimatedPose;
 
-		map.updatePose(correctedPose);
+		// velocity since the previous input, used to prefetch the cells ahead of the robot
+		PM::Vector velocity = PM::Vector::Zero(euclideanDim);
+		const float elapsedTime = std::chrono::duration<float>(timeStamp - lastInputTimeStamp).count();
+		if(pose.size() > 0 && elapsedTime > 0)
+		{
+			velocity = (correctedPose.topRightCorner(euclideanDim, 1) - pose.topRightCorner(euclideanDim, 1)) / elapsedTime;
+		}
+
+		map.updatePose(correctedPose, velocity);
 
-		if(shouldUpdateMap(timeStamp, correctedPose, icp.errorMinimizer->getOverlap()))
+		// the ratio of new points is estimated only if the map update policy uses it
+		auto estimateNewPointRatio = [&]()
+		{
+			return map.estimateNewPointRatio(transformation->compute(input, correction));
+		};
+		if(shouldUpdateMap(timeStamp, correctedPose, overlap, estimateNewPointRatio))
 		{
 			updateMap(transformation->compute(input, correction), correctedPose, timeStamp);
 		}
 	}
 
-	poseLock.lock();
+	// readers of the pose get an immutable snapshot, so that they never wait for the registration thread
 	pose = correctedPose;
-	poseLock.unlock();
+	std::atomic_store(&publishedPose, std::make_shared<const PM::TransformationParameters>(correctedPose));
+	lastInputTimeStamp = timeStamp;
 
-	int euclideanDim = is3D ? 3 : 2;
 	trajectoryLock.lock();
 	trajectory.addPoint(correctedPose.topRightCorner(euclideanDim, 1));
 	trajectoryLock.unlock();
+
+	return correctedPose;
 }
 
 bool norlab_icp_mapper::Mapper::shouldUpdateMap(const std::chrono::time_point<std::chrono::steady_clock>& currentTime,
-												const PM::TransformationParameters& currentPose, const float& currentOverlap) const
+												const PM::TransformationParameters& currentPose, const float& currentOverlap,
+												const std::function<float()>& estimateNewPointRatio) const
 {
 	if(!isMapping.load())
 	{
@@ -119,26 +254,14 @@ bool norlab_icp_mapper::Mapper::shouldUpdateMap(const std::chrono::time_point<st
 		}
 	}
 
-	if(mapUpdateCondition == "overlap")
-	{
-		return currentOverlap < mapUpdateOverlap;
-	}
-	else if(mapUpdateCondition == "delay")
-	{
-		return (currentTime - lastTimeMapWasUpdated) > std::chrono::duration<float>(mapUpdateDelay);
-	}
-	else
-	{
-		int euclideanDim = is3D ? 3 : 2;
-		PM::Vector lastLocation = lastPoseWhereMapWasUpdated.topRightCorner(euclideanDim, 1);
-		PM::Vector currentLocation = currentPose.topRightCorner(euclideanDim, 1);
-		return std::fabs((currentLocation - lastLocation).norm()) > mapUpdateDistance;
-	}
+	return mapUpdatePolicy->shouldUpdateMap(MapUpdateState{currentTime, currentPose, currentOverlap, lastTimeMapWasUpdated, lastPoseWhereMapWasUpdated,
+															estimateNewPointRatio});
 }
 
 void norlab_icp_mapper::Mapper::updateMap(const PM::DataPoints& currentInput, const PM::TransformationParameters& currentPose,
 										  const std::chrono::time_point<std::chrono::steady_clock>& currentTimeStamp)
 {
+	Profiler::Span mapUpdateDispatchSpan(profiler, Profiler::MAP_UPDATE_DISPATCH);
 	lastTimeMapWasUpdated = currentTimeStamp;
 	lastPoseWhereMapWasUpdated = currentPose;
 
@@ -157,6 +280,16 @@ norlab_icp_mapper::Mapper::PM::DataPoints norlab_icp_mapper::Mapper::getMap()
 	return map.getGlobalPointCloud();
 }
 
+void norlab_icp_mapper::Mapper::visitMap(const std::function<void(const CellId&, const PM::DataPoints&)>& visitor)
+{
+	map.visitGlobalPointCloud(visitor);
+}
+
+void norlab_icp_mapper::Mapper::saveMap(const std::string& fileName)
+{
+	map.saveGlobalPointCloud(fileName);
+}
+
 void norlab_icp_mapper::Mapper::setMap(const PM::DataPoints& newMap)
 {
 	map.setGlobalPointCloud(newMap);
@@ -165,15 +298,32 @@ void norlab_icp_mapper::Mapper::setMap(const PM::DataPoints& newMap)
 	trajectoryLock.unlock();
 }
 
+void norlab_icp_mapper::Mapper::setMap(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints> cells)
+{
+	map.setGlobalPointCloud(cellIds, std::move(cells));
+	trajectoryLock.lock();
+	trajectory.clearPoints();
+	trajectoryLock.unlock();
+}
+
 bool norlab_icp_mapper::Mapper::getNewLocalMap(PM::DataPoints& mapOut)
 {
 	return map.getNewLocalPointCloud(mapOut);
 }
 
+bool norlab_icp_mapper::Mapper::getNewLocalMap(std::shared_ptr<const PM::DataPoints>& mapOut)
+{
+	return map.getNewLocalPointCloud(mapOut);
+}
+
+norlab_icp_mapper::LocalPointCloudDelta norlab_icp_mapper::Mapper::getLocalMapDelta(const std::uint64_t& version)
+{
+	return map.getLocalPointCloudDelta(version);
+}
+
 norlab_icp_mapper::Mapper::PM::TransformationParameters norlab_icp_mapper::Mapper::getPose()
 {
-	std::lock_guard<std::mutex> lock(poseLock);
-	return pose;
+	return *std::atomic_load(&publishedPose);
 }
 
 bool norlab_icp_mapper::Mapper::getIsMapping() const
@@ -188,6 +338,45 @@ void norlab_icp_mapper::Mapper::setIsMapping(const bool& newIsMapping)
 
 Trajectory norlab_icp_mapper::Mapper::getTrajectory()
 {
-	std::lock_guard<std::mutex> lock(trajectoryLock);
+	// trajectoryLock only serializes the writers
 	return trajectory;
 }
+
+norlab_icp_mapper::Mapper::PM::Matrix norlab_icp_mapper::Mapper::getTrajectoryPoints(const int& startIndex)
+{
+	return trajectory.getPoints(startIndex);
+}
+
+norlab_icp_mapper::CellCacheStats norlab_icp_mapper::Mapper::getCellCacheStats() const
+{
+	return map.getCellCacheStats();
+}
+
+norlab_icp_mapper::MapperStats norlab_icp_mapper::Mapper::getStats()
+{
+	MapperStats stats;
+	for(int i = 0; i < Profiler::NB_STAGES; i++)
+	{
+		stats.stages[i] = profiler.getStageStats(static_cast<Profiler::Stage>(i));
+	}
+	stats.map = map.getStats();
+	stats.cellMatcher = icp.getCellMatcherStats();
+	stats.nbInputsToFilter = inputsToFilter.size();
+	stats.nbInputsToRegister = inputsToRegister.size();
+	return stats;
+}
+
+void norlab_icp_mapper::Mapper::startTrace(const std::size_t& maxNbEvents)
+{
+	profiler.startTrace(maxNbEvents);
+}
+
+void norlab_icp_mapper::Mapper::stopTrace()
+{
+	profiler.stopTrace();
+}
+
+void norlab_icp_mapper::Mapper::saveTrace(const std::string& fileName)
+{
+	profiler.saveTrace(fileName);
+}
@@ -4,61 +4,124 @@
 #include <pointmatcher/PointMatcher.h>
 #include "Map.h"
 #include "Trajectory.h"
+#include "DoubleBufferedICP.h"
+#include "BoundedQueue.h"
+#include "Profiler.h"
+#include "ThreadPool.h"
+#include "MapUpdatePolicy.h"
 #include <future>
 #include <mutex>
+#include <thread>
 
 namespace norlab_icp_mapper
 {
+	typedef struct ProcessedInput
+	{
+		PointMatcher<float>::TransformationParameters correctedPose;
+		PointMatcher<float>::DataPoints filteredInputInSensorFrame;
+	} ProcessedInput;
+
+	typedef struct MapperStats
+	{
+		StageStats stages[Profiler::NB_STAGES];
+		MapStats map;
+		CellMatcherStats cellMatcher;
+		std::size_t nbInputsToFilter;
+		std::size_t nbInputsToRegister;
+	} MapperStats;
+
 	class Mapper
 	{
 	private:
 		typedef PointMatcher<float> PM;
 
+		typedef struct PendingInput
+		{
+			PM::DataPoints inputInSensorFrame;
+			PM::TransformationParameters estimatedPose;
+			std::chrono::time_point<std::chrono::steady_clock> timeStamp;
+			std::shared_ptr<std::promise<ProcessedInput>> result;
+		} PendingInput;
+
+		Profiler profiler;
+		ThreadPool threadPool;
 		PM::DataPointsFilters inputFilters;
-		PM::ICPSequence icp;
+		DoubleBufferedICP icp;
 		PM::DataPointsFilters mapPostFilters;
-		std::string mapUpdateCondition;
-		float mapUpdateOverlap;
-		float mapUpdateDelay;
-		float mapUpdateDistance;
+		std::unique_ptr<MapUpdatePolicy> mapUpdatePolicy;
 		bool is3D;
 		bool isOnline;
+		bool incrementalReference;
 		std::atomic_bool isMapping;
 		Map map;
 		PM::TransformationParameters pose;
+		std::shared_ptr<const PM::TransformationParameters> publishedPose;
 		Trajectory trajectory;
 		std::shared_ptr<PM::Transformation> transformation;
 		std::shared_ptr<PM::DataPointsFilter> radiusFilter;
 		std::chrono::time_point<std::chrono::steady_clock> lastTimeMapWasUpdated;
 		PM::TransformationParameters lastPoseWhereMapWasUpdated;
-		std::mutex poseLock;
+		std::chrono::time_point<std::chrono::steady_clock> lastInputTimeStamp;
 		std::mutex trajectoryLock;
-		std::mutex icpMapLock;
 		std::future<void> mapUpdateFuture;
+		BoundedQueue<PendingInput> inputsToFilter;
+		BoundedQueue<PendingInput> inputsToRegister;
+		std::thread filteringThread;
+		std::thread registrationThread;
+		std::once_flag pipelineStartFlag;
 
+		void startPipeline();
+		void filteringThreadFunction();
+		void registrationThreadFunction();
+		void dropInput(PendingInput& input);
+		PM::DataPoints filterInput(const PM::DataPoints& inputInSensorFrame);
+		PM::TransformationParameters registerInput(const PM::DataPoints& filteredInputInSensorFrame, const PM::TransformationParameters& estimatedPose,
+												   const std::chrono::time_point<std::chrono::steady_clock>& timeStamp);
 		bool shouldUpdateMap(const std::chrono::time_point<std::chrono::steady_clock>& currentTime, const PM::TransformationParameters& currentPose,
-							 const float& currentOverlap) const;
+							 const float& currentOverlap, const std::function<float()>& estimateNewPointRatio) const;
 		void updateMap(const PM::DataPoints& currentInput, const PM::TransformationParameters& currentPose,
 					   const std::chrono::time_point<std::chrono::steady_clock>& currentTimeStamp);
 
 	public:
+		// parameters added after saveMapCellsOnHardDrive have defaults keeping the original behavior, new ones have to be appended after them
 		Mapper(const std::string& inputFiltersConfigFilePath, const std::string& icpConfigFilePath, const std::string& mapPostFiltersConfigFilePath,
 			   const std::string& mapUpdateCondition, const float& mapUpdateOverlap, const float& mapUpdateDelay, const float& mapUpdateDistance,
 			   const float& minDistNewPoint, const float& sensorMaxRange, const float& priorDynamic, const float& thresholdDynamic, const float& beamHalfAngle,
 			   const float& epsilonA, const float& epsilonD, const float& alpha, const float& beta, const bool& is3D, const bool& isOnline,
-			   const bool& computeProbDynamic, const bool& isMapping, const bool& saveMapCellsOnHardDrive);
+			   const bool& computeProbDynamic, const bool& isMapping, const bool& saveMapCellsOnHardDrive, const bool& incrementalReference = false,
+			   const std::string& beamSearchMethod = "kdtree", const std::string& hardDriveCellStore = "files",
+			   const std::string& hardDriveCellFolder = "/tmp/", const float& hardDriveCellCacheSize = 0, const int& inputQueueSize = 1,
+			   const std::string& inputQueuePolicy = "block", const float& mapUpdateRotation = 0.2, const float& mapUpdateNewPointRatio = 0.05,
+			   const float& submapLength = 0, const float& cellSize = 20.0, const int& bufferSize = 2, const int& nbThreads = 0,
+			   const float& postFilterMargin = 2.0);
+		~Mapper();
 		void loadYamlConfig(const std::string& inputFiltersConfigFilePath, const std::string& icpConfigFilePath,
 							const std::string& mapPostFiltersConfigFilePath);
 		void processInput(const PM::DataPoints& inputInSensorFrame, const PM::TransformationParameters& estimatedPose,
 						  const std::chrono::time_point<std::chrono::steady_clock>& timeStamp,
 						  PM::DataPoints& filteredInputInSensorFrame);
+		std::future<ProcessedInput> submitInput(const PM::DataPoints& inputInSensorFrame, const PM::TransformationParameters& estimatedPose,
+												const std::chrono::time_point<std::chrono::steady_clock>& timeStamp);
 		PM::DataPoints getMap();
+		void visitMap(const std::function<void(const CellId&, const PM::DataPoints&)>& visitor);
+		void saveMap(const std::string& fileName);
 		void setMap(const PM::DataPoints& newMap);
+		// set a map already partitioned into cells of the map cell size, such as the ones given by visitMap
+		void setMap(const std::vector<CellId>& cellIds, std::vector<PM::DataPoints> cells);
 		bool getNewLocalMap(PM::DataPoints& mapOut);
+		bool getNewLocalMap(std::shared_ptr<const PM::DataPoints>& mapOut);
+		LocalPointCloudDelta getLocalMapDelta(const std::uint64_t& version);
 		PM::TransformationParameters getPose();
 		bool getIsMapping() const;
 		void setIsMapping(const bool& newIsMapping);
 		Trajectory getTrajectory();
+		// positions added to the trajectory since startIndex, one per column, which lets readers poll it incrementally
+		PM::Matrix getTrajectoryPoints(const int& startIndex);
+		CellCacheStats getCellCacheStats() const;
+		MapperStats getStats();
+		void startTrace(const std::size_t& maxNbEvents);
+		void stopTrace();
+		void saveTrace(const std::string& fileName);
 	};
 }
 
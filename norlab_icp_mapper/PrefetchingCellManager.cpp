@@ -0,0 +1,211 @@
+#include "PrefetchingCellManager.h"
+#include <unordered_set>
+
+norlab_icp_mapper::PrefetchingCellManager::PrefetchingCellManager(std::unique_ptr<CellManager> cellManager):
+		cellManager(std::move(cellManager)),
+		prefetchThreadLooping(true)
+{
+	prefetchThread = std::thread(&PrefetchingCellManager::prefetchThreadFunction, this);
+}
+
+norlab_icp_mapper::PrefetchingCellManager::~PrefetchingCellManager()
+{
+	prefetchListLock.lock();
+	prefetchThreadLooping.store(false);
+	prefetchListLock.unlock();
+	prefetchListCondition.notify_one();
+	prefetchThread.join();
+}
+
+void norlab_icp_mapper::PrefetchingCellManager::prefetchThreadFunction()
+{
+	std::unique_lock<std::mutex> prefetchListGuard(prefetchListLock);
+	while(prefetchThreadLooping.load())
+	{
+		prefetchListCondition.wait(prefetchListGuard, [this]
+		{
+			return !prefetchList.empty() || !prefetchThreadLooping.load();
+		});
+
+		while(!prefetchList.empty() && prefetchThreadLooping.load())
+		{
+			CellId cellId = prefetchList.front();
+			prefetchList.pop_front();
+			prefetchListGuard.unlock();
+
+			{
+				// the cell manager stays locked until the cell is staged, so that a concurrent save cannot be overwritten by an older version
+				std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+				prefetchedCellsLock.lock();
+				bool isCellPrefetched = prefetchedCells.find(cellId) != prefetchedCells.end();
+				prefetchedCellsLock.unlock();
+
+				// cells the cell manager holds in memory, like the ones in a cache, would only be copied
+				if(!isCellPrefetched && cellManager->viewCell(cellId) == nullptr)
+				{
+					PM::DataPoints cell = cellManager->retrieveCell(cellId);
+					if(cell.getNbPoints() > 0)
+					{
+						prefetchedCellsLock.lock();
+						prefetchedCells.emplace(cellId, std::move(cell));
+						prefetchedCellsLock.unlock();
+					}
+				}
+			}
+
+			prefetchListGuard.lock();
+		}
+	}
+}
+
+std::vector<norlab_icp_mapper::CellId> norlab_icp_mapper::PrefetchingCellManager::getAllCellIds() const
+{
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	return cellManager->getAllCellIds();
+}
+
+void norlab_icp_mapper::PrefetchingCellManager::saveCell(const CellId& cellId, const PM::DataPoints& cell)
+{
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	prefetchedCellsLock.lock();
+	prefetchedCells.erase(cellId);
+	prefetchedCellsLock.unlock();
+	cellManager->saveCell(cellId, cell);
+}
+
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::PrefetchingCellManager::retrieveCell(const CellId& cellId) const
+{
+	prefetchedCellsLock.lock();
+	auto prefetchedCell = prefetchedCells.find(cellId);
+	if(prefetchedCell != prefetchedCells.end())
+	{
+		PM::DataPoints cell = prefetchedCell->second;
+		prefetchedCellsLock.unlock();
+		return cell;
+	}
+	prefetchedCellsLock.unlock();
+
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	return cellManager->retrieveCell(cellId);
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::PrefetchingCellManager::retrieveCells(const std::vector<CellId>& cellIds) const
+{
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	return cellManager->retrieveCells(cellIds);
+}
+
+std::vector<norlab_icp_mapper::CellManager::PM::DataPoints> norlab_icp_mapper::PrefetchingCellManager::takeCells(const std::vector<CellId>& cellIds)
+{
+	std::vector<PM::DataPoints> cells(cellIds.size());
+	std::vector<CellId> missedCellIds;
+	std::vector<int> missedCellIndices;
+	prefetchedCellsLock.lock();
+	for(int i = 0; i < cellIds.size(); i++)
+	{
+		auto prefetchedCell = prefetchedCells.find(cellIds[i]);
+		if(prefetchedCell != prefetchedCells.end())
+		{
+			cells[i] = std::move(prefetchedCell->second);
+			prefetchedCells.erase(prefetchedCell);
+		}
+		else
+		{
+			missedCellIds.push_back(cellIds[i]);
+			missedCellIndices.push_back(i);
+		}
+	}
+	prefetchedCellsLock.unlock();
+
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	std::vector<PM::DataPoints> missedCells = cellManager->takeCells(missedCellIds);
+	for(int i = 0; i < missedCells.size(); i++)
+	{
+		cells[missedCellIndices[i]] = std::move(missedCells[i]);
+	}
+	return cells;
+}
+
+void norlab_icp_mapper::PrefetchingCellManager::clearAllCells()
+{
+	prefetchListLock.lock();
+	prefetchList.clear();
+	prefetchListLock.unlock();
+
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	prefetchedCellsLock.lock();
+	prefetchedCells.clear();
+	prefetchedCellsLock.unlock();
+	cellManager->clearAllCells();
+}
+
+void norlab_icp_mapper::PrefetchingCellManager::prefetchCells(const std::vector<CellId>& cellIds)
+{
+	std::unordered_set<CellId, CellIdHash> requestedCellIds(cellIds.begin(), cellIds.end());
+
+	// cells that are not requested anymore are dropped to bound memory usage
+	prefetchedCellsLock.lock();
+	for(auto prefetchedCell = prefetchedCells.begin(); prefetchedCell != prefetchedCells.end();)
+	{
+		if(requestedCellIds.find(prefetchedCell->first) == requestedCellIds.end())
+		{
+			prefetchedCell = prefetchedCells.erase(prefetchedCell);
+		}
+		else
+		{
+			requestedCellIds.erase(prefetchedCell->first);
+			++prefetchedCell;
+		}
+	}
+	prefetchedCellsLock.unlock();
+
+	prefetchListLock.lock();
+	prefetchList.clear();
+	for(const auto& cellId: cellIds)
+	{
+		if(requestedCellIds.find(cellId) != requestedCellIds.end())
+		{
+			prefetchList.push_back(cellId);
+		}
+	}
+	prefetchListLock.unlock();
+	prefetchListCondition.notify_one();
+}
+
+void norlab_icp_mapper::PrefetchingCellManager::saveCell(const CellId& cellId, PM::DataPoints&& cell)
+{
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	prefetchedCellsLock.lock();
+	prefetchedCells.erase(cellId);
+	prefetchedCellsLock.unlock();
+	cellManager->saveCell(cellId, std::move(cell));
+}
+
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::PrefetchingCellManager::takeCell(const CellId& cellId)
+{
+	prefetchedCellsLock.lock();
+	auto prefetchedCell = prefetchedCells.find(cellId);
+	if(prefetchedCell != prefetchedCells.end())
+	{
+		PM::DataPoints cell = std::move(prefetchedCell->second);
+		prefetchedCells.erase(prefetchedCell);
+		prefetchedCellsLock.unlock();
+		return cell;
+	}
+	prefetchedCellsLock.unlock();
+
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	return cellManager->takeCell(cellId);
+}
+
+const norlab_icp_mapper::CellManager::PM::DataPoints* norlab_icp_mapper::PrefetchingCellManager::viewCell(const CellId& cellId) const
+{
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	return cellManager->viewCell(cellId);
+}
+
+void norlab_icp_mapper::PrefetchingCellManager::flush()
+{
+	std::lock_guard<std::mutex> cellManagerGuard(cellManagerLock);
+	cellManager->flush();
+}
@@ -0,0 +1,47 @@
+#ifndef PREFETCHING_CELL_MANAGER_H
+#define PREFETCHING_CELL_MANAGER_H
+
+#include "CellManager.h"
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <list>
+
+namespace norlab_icp_mapper
+{
+	// Cell manager retrieving cells from another cell manager in the background, so that they are already in memory when they are requested.
+	class PrefetchingCellManager : public CellManager
+	{
+	private:
+		std::unique_ptr<CellManager> cellManager;
+		mutable std::mutex cellManagerLock;
+		mutable std::unordered_map<CellId, PM::DataPoints, CellIdHash> prefetchedCells;
+		mutable std::mutex prefetchedCellsLock;
+		std::list<CellId> prefetchList;
+		std::mutex prefetchListLock;
+		std::condition_variable prefetchListCondition;
+		std::atomic_bool prefetchThreadLooping;
+		std::thread prefetchThread;
+
+		void prefetchThreadFunction();
+
+	public:
+		PrefetchingCellManager(std::unique_ptr<CellManager> cellManager);
+		~PrefetchingCellManager() override;
+		std::vector<CellId> getAllCellIds() const override;
+		void saveCell(const CellId& cellId, const PM::DataPoints& cell) override;
+		PM::DataPoints retrieveCell(const CellId& cellId) const override;
+		void clearAllCells() override;
+		std::vector<PM::DataPoints> retrieveCells(const std::vector<CellId>& cellIds) const override;
+		std::vector<PM::DataPoints> takeCells(const std::vector<CellId>& cellIds) override;
+		void prefetchCells(const std::vector<CellId>& cellIds) override;
+		void saveCell(const CellId& cellId, PM::DataPoints&& cell) override;
+		PM::DataPoints takeCell(const CellId& cellId) override;
+		const PM::DataPoints* viewCell(const CellId& cellId) const override;
+		void flush() override;
+	};
+}
+
+#endif
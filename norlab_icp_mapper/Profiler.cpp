@@ -0,0 +1,130 @@
+#include "Profiler.h"
+#include <fstream>
+#include <unordered_map>
+#include <stdexcept>
+
+norlab_icp_mapper::Profiler::Span::Span(Profiler& profiler, const Stage& stage):
+		profiler(profiler),
+		stage(stage),
+		start(std::chrono::steady_clock::now())
+{
+}
+
+norlab_icp_mapper::Profiler::Span::~Span()
+{
+	profiler.record(stage, start, std::chrono::steady_clock::now());
+}
+
+norlab_icp_mapper::Profiler::Profiler():
+		creationTime(std::chrono::steady_clock::now()),
+		isTracing(false),
+		maxNbTraceEvents(0)
+{
+	for(int i = 0; i < NB_STAGES; i++)
+	{
+		counts[i].store(0);
+		totalDurations[i].store(0);
+		maxDurations[i].store(0);
+	}
+}
+
+void norlab_icp_mapper::Profiler::record(const Stage& stage, const std::chrono::steady_clock::time_point& start,
+										 const std::chrono::steady_clock::time_point& end)
+{
+	const std::uint64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+	counts[stage].fetch_add(1, std::memory_order_relaxed);
+	totalDurations[stage].fetch_add(duration, std::memory_order_relaxed);
+	std::uint64_t maxDuration = maxDurations[stage].load(std::memory_order_relaxed);
+	while(duration > maxDuration && !maxDurations[stage].compare_exchange_weak(maxDuration, duration, std::memory_order_relaxed))
+	{
+	}
+
+	if(isTracing.load(std::memory_order_relaxed))
+	{
+		std::lock_guard<std::mutex> traceEventsGuard(traceEventsLock);
+		// events past the capacity of the trace are dropped, so that tracing for too long does not exhaust the memory
+		if(traceEvents.size() < maxNbTraceEvents)
+		{
+			traceEvents.push_back(TraceEvent{stage, std::this_thread::get_id(), start, end});
+		}
+	}
+}
+
+norlab_icp_mapper::StageStats norlab_icp_mapper::Profiler::getStageStats(const Stage& stage) const
+{
+	return StageStats{counts[stage].load(), totalDurations[stage].load(), maxDurations[stage].load()};
+}
+
+void norlab_icp_mapper::Profiler::startTrace(const std::size_t& maxNbEvents)
+{
+	std::lock_guard<std::mutex> traceEventsGuard(traceEventsLock);
+	traceEvents.clear();
+	traceEvents.reserve(maxNbEvents);
+	maxNbTraceEvents = maxNbEvents;
+	isTracing.store(true);
+}
+
+void norlab_icp_mapper::Profiler::stopTrace()
+{
+	isTracing.store(false);
+}
+
+void norlab_icp_mapper::Profiler::saveTrace(const std::string& fileName)
+{
+	std::ofstream ofs(fileName);
+	if(!ofs)
+	{
+		throw std::runtime_error("unable to write " + fileName + ".");
+	}
+
+	std::lock_guard<std::mutex> traceEventsGuard(traceEventsLock);
+	std::unordered_map<std::thread::id, int> threadIds;
+	ofs << "{\"traceEvents\":[";
+	for(int i = 0; i < traceEvents.size(); i++)
+	{
+		const TraceEvent& event = traceEvents[i];
+		auto threadId = threadIds.emplace(event.threadId, threadIds.size()).first;
+		const double start = std::chrono::duration<double, std::micro>(event.start - creationTime).count();
+		const double duration = std::chrono::duration<double, std::micro>(event.end - event.start).count();
+		ofs << (i == 0 ? "" : ",") << "\n{\"name\":\"" << getStageName(event.stage) << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << threadId->second
+			<< ",\"ts\":" << std::fixed << start << ",\"dur\":" << duration << "}";
+	}
+	ofs << "\n]}\n";
+}
+
+std::string norlab_icp_mapper::Profiler::getStageName(const Stage& stage)
+{
+	switch(stage)
+	{
+		case RADIUS_FILTER:
+			return "radiusFilter";
+		case INPUT_FILTERS:
+			return "inputFilters";
+		case ICP:
+			return "icp";
+		case MAP_UPDATE_DISPATCH:
+			return "mapUpdateDispatch";
+		case DYNAMIC_PROBABILITY:
+			return "dynamicProbability";
+		case MIN_DIST_INSERTION:
+			return "minDistInsertion";
+		case POST_FILTERS:
+			return "postFilters";
+		case SET_MAP:
+			return "setMap";
+		case LOAD_CELLS:
+			return "loadCells";
+		case UNLOAD_CELLS:
+			return "unloadCells";
+		case CELL_RETRIEVAL:
+			return "cellRetrieval";
+		case CELL_SAVING:
+			return "cellSaving";
+		case ICP_BUFFER_LOCK_WAIT:
+			return "icpBufferLockWait";
+		case LOCAL_POINT_CLOUD_LOCK_WAIT:
+			return "localPointCloudLockWait";
+		default:
+			throw std::runtime_error("invalid profiler stage: " + std::to_string(stage) + ".");
+	}
+}
@@ -0,0 +1,87 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+
+namespace norlab_icp_mapper
+{
+	// Durations are in nanoseconds.
+	typedef struct StageStats
+	{
+		std::uint64_t count;
+		std::uint64_t totalDuration;
+		std::uint64_t maxDuration;
+	} StageStats;
+
+	// Accumulator of the time spent in each stage of the mapping pipeline. Spans can also be recorded as a trace, which is saved in the Chrome
+	// trace format.
+	class Profiler
+	{
+	public:
+		enum Stage
+		{
+			RADIUS_FILTER,
+			INPUT_FILTERS,
+			ICP,
+			MAP_UPDATE_DISPATCH,
+			DYNAMIC_PROBABILITY,
+			MIN_DIST_INSERTION,
+			POST_FILTERS,
+			SET_MAP,
+			LOAD_CELLS,
+			UNLOAD_CELLS,
+			CELL_RETRIEVAL,
+			CELL_SAVING,
+			ICP_BUFFER_LOCK_WAIT,
+			LOCAL_POINT_CLOUD_LOCK_WAIT,
+			NB_STAGES
+		};
+
+		// Records the time elapsed between its construction and its destruction.
+		class Span
+		{
+		private:
+			Profiler& profiler;
+			const Stage stage;
+			const std::chrono::steady_clock::time_point start;
+
+		public:
+			Span(Profiler& profiler, const Stage& stage);
+			~Span();
+		};
+
+	private:
+		typedef struct TraceEvent
+		{
+			Stage stage;
+			std::thread::id threadId;
+			std::chrono::steady_clock::time_point start;
+			std::chrono::steady_clock::time_point end;
+		} TraceEvent;
+
+		const std::chrono::steady_clock::time_point creationTime;
+		std::atomic<std::uint64_t> counts[NB_STAGES];
+		std::atomic<std::uint64_t> totalDurations[NB_STAGES];
+		std::atomic<std::uint64_t> maxDurations[NB_STAGES];
+		std::atomic_bool isTracing;
+		std::size_t maxNbTraceEvents;
+		std::vector<TraceEvent> traceEvents;
+		std::mutex traceEventsLock;
+
+	public:
+		Profiler();
+		void record(const Stage& stage, const std::chrono::steady_clock::time_point& start, const std::chrono::steady_clock::time_point& end);
+		StageStats getStageStats(const Stage& stage) const;
+		void startTrace(const std::size_t& maxNbEvents);
+		void stopTrace();
+		void saveTrace(const std::string& fileName);
+		static std::string getStageName(const Stage& stage);
+	};
+}
+
+#endif
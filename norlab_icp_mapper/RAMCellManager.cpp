@@ -1,8 +1,8 @@
 #include "RAMCellManager.h"
 
-std::vector<std::string> norlab_icp_mapper::RAMCellManager::getAllCellIds() const
+std::vector<norlab_icp_mapper::CellId> norlab_icp_mapper::RAMCellManager::getAllCellIds() const
 {
-	std::vector<std::string> cellIds;
+	std::vector<CellId> cellIds;
 	for(const auto& cell : cells)
 	{
 		cellIds.push_back(cell.first);
@@ -10,17 +10,18 @@ std::vector<std::string> norlab_icp_mapper::RAMCellManager::getAllCellIds() cons
 	return cellIds;
 }
 
-void norlab_icp_mapper::RAMCellManager::saveCell(const std::string& cellId, const PM::DataPoints& cell)
+void norlab_icp_mapper::RAMCellManager::saveCell(const CellId& cellId, const PM::DataPoints& cell)
 {
 	cells[cellId] = cell;
 }
 
-norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::RAMCellManager::retrieveCell(const std::string& cellId) const
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::RAMCellManager::retrieveCell(const CellId& cellId) const
 {
 	PM::DataPoints cell;
-	if(cells.find(cellId) != cells.end())
+	auto storedCell = cells.find(cellId);
+	if(storedCell != cells.end())
 	{
-		cell = cells.at(cellId);
+		cell = storedCell->second;
 	}
 	return cell;
 }
@@ -29,3 +30,26 @@ void norlab_icp_mapper::RAMCellManager::clearAllCells()
 {
 	cells.clear();
 }
+
+void norlab_icp_mapper::RAMCellManager::saveCell(const CellId& cellId, PM::DataPoints&& cell)
+{
+	cells[cellId] = std::move(cell);
+}
+
+norlab_icp_mapper::CellManager::PM::DataPoints norlab_icp_mapper::RAMCellManager::takeCell(const CellId& cellId)
+{
+	PM::DataPoints cell;
+	auto storedCell = cells.find(cellId);
+	if(storedCell != cells.end())
+	{
+		cell = std::move(storedCell->second);
+		cells.erase(storedCell);
+	}
+	return cell;
+}
+
+const norlab_icp_mapper::CellManager::PM::DataPoints* norlab_icp_mapper::RAMCellManager::viewCell(const CellId& cellId) const
+{
+	auto storedCell = cells.find(cellId);
+	return storedCell != cells.end() ? &storedCell->second : nullptr;
+}
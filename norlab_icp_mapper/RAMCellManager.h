@@ -9,13 +9,16 @@ namespace norlab_icp_mapper
 	class RAMCellManager : public CellManager
 	{
 	private:
-		std::unordered_map<std::string, PM::DataPoints> cells;
+		std::unordered_map<CellId, PM::DataPoints, CellIdHash> cells;
 
 	public:
-		std::vector<std::string> getAllCellIds() const override;
-		void saveCell(const std::string& cellId, const PM::DataPoints& cell) override;
-		PM::DataPoints retrieveCell(const std::string& cellId) const override;
+		std::vector<CellId> getAllCellIds() const override;
+		void saveCell(const CellId& cellId, const PM::DataPoints& cell) override;
+		PM::DataPoints retrieveCell(const CellId& cellId) const override;
 		void clearAllCells() override;
+		void saveCell(const CellId& cellId, PM::DataPoints&& cell) override;
+		PM::DataPoints takeCell(const CellId& cellId) override;
+		const PM::DataPoints* viewCell(const CellId& cellId) const override;
 	};
 }
 
@@ -0,0 +1,57 @@
+#include "RangeImage.h"
+
+norlab_icp_mapper::RangeImage::RangeImage(const PM::Matrix& angles, const float& pixelSize):
+		angles(angles),
+		pixelSize(pixelSize),
+		nbRows(std::ceil(M_PI / pixelSize) + 1),
+		nbColumns(std::ceil(2 * M_PI / pixelSize) + 1),
+		pixelFirstBeams(nbRows * nbColumns, EMPTY_PIXEL),
+		nextBeams(angles.cols())
+{
+	for(int i = 0; i < angles.cols(); i++)
+	{
+		const int pixel = toRow(angles(0, i)) * nbColumns + toColumn(angles(1, i));
+		nextBeams[i] = pixelFirstBeams[pixel];
+		pixelFirstBeams[pixel] = i;
+	}
+}
+
+void norlab_icp_mapper::RangeImage::findClosestBeams(const PM::Matrix& queryAngles, const float& maxDist, PM::Matches::Ids& ids,
+													 PM::Matches::Dists& dists) const
+{
+	// the azimuth does not wrap around, so that results are the same as with a kd-tree on the angles
+	const int pixelRange = std::ceil(maxDist / pixelSize);
+	const float squaredMaxDist = maxDist * maxDist;
+	ids = PM::Matches::Ids::Constant(1, queryAngles.cols(), PM::Matches::InvalidId);
+	dists = PM::Matches::Dists::Constant(1, queryAngles.cols(), std::numeric_limits<float>::infinity());
+	for(int i = 0; i < queryAngles.cols(); i++)
+	{
+		const int row = toRow(queryAngles(0, i));
+		const int column = toColumn(queryAngles(1, i));
+		for(int j = std::max(row - pixelRange, 0); j <= std::min(row + pixelRange, nbRows - 1); j++)
+		{
+			for(int k = std::max(column - pixelRange, 0); k <= std::min(column + pixelRange, nbColumns - 1); k++)
+			{
+				for(int beamId = pixelFirstBeams[j * nbColumns + k]; beamId != EMPTY_PIXEL; beamId = nextBeams[beamId])
+				{
+					const float squaredDist = (angles.col(beamId) - queryAngles.col(i)).squaredNorm();
+					if(squaredDist <= squaredMaxDist && squaredDist < dists(0, i))
+					{
+						dists(0, i) = squaredDist;
+						ids(0, i) = beamId;
+					}
+				}
+			}
+		}
+	}
+}
+
+int norlab_icp_mapper::RangeImage::toRow(const float& elevation) const
+{
+	return std::min(std::max(static_cast<int>(std::floor((elevation + M_PI_2) / pixelSize)), 0), nbRows - 1);
+}
+
+int norlab_icp_mapper::RangeImage::toColumn(const float& azimuth) const
+{
+	return std::min(std::max(static_cast<int>(std::floor((azimuth + M_PI) / pixelSize)), 0), nbColumns - 1);
+}
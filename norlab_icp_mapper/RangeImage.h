@@ -0,0 +1,32 @@
+#ifndef RANGE_IMAGE_H
+#define RANGE_IMAGE_H
+
+#include <pointmatcher/PointMatcher.h>
+
+namespace norlab_icp_mapper
+{
+	// Fixed resolution elevation/azimuth grid of the beams of a scan, used to find the closest beam of a direction in constant time.
+	class RangeImage
+	{
+	private:
+		typedef PointMatcher<float> PM;
+
+		const int EMPTY_PIXEL = -1;
+
+		PM::Matrix angles;
+		float pixelSize;
+		int nbRows;
+		int nbColumns;
+		std::vector<int> pixelFirstBeams;
+		std::vector<int> nextBeams;
+
+		int toRow(const float& elevation) const;
+		int toColumn(const float& azimuth) const;
+
+	public:
+		RangeImage(const PM::Matrix& angles, const float& pixelSize);
+		void findClosestBeams(const PM::Matrix& queryAngles, const float& maxDist, PM::Matches::Ids& ids, PM::Matches::Dists& dists) const;
+	};
+}
+
+#endif
@@ -0,0 +1,112 @@
+#include "ThreadPool.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+norlab_icp_mapper::ThreadPool::ThreadPool(const int& nbThreads):
+		stopping(false)
+{
+	if(nbThreads < 0)
+	{
+		throw std::runtime_error("invalid number of threads: " + std::to_string(nbThreads) + ", expected a non-negative value.");
+	}
+
+	const int nbWorkers = (nbThreads == 0 ? std::max<int>(1, std::thread::hardware_concurrency()) : nbThreads) - 1;
+	for(int i = 0; i < nbWorkers; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerFunction, this);
+	}
+}
+
+norlab_icp_mapper::ThreadPool::~ThreadPool()
+{
+	jobsLock.lock();
+	stopping = true;
+	jobsLock.unlock();
+	jobsCondition.notify_all();
+	for(auto& worker: workers)
+	{
+		worker.join();
+	}
+}
+
+int norlab_icp_mapper::ThreadPool::getNbThreads() const
+{
+	return workers.size() + 1;
+}
+
+void norlab_icp_mapper::ThreadPool::workerFunction()
+{
+	std::unique_lock<std::mutex> jobsGuard(jobsLock);
+	while(true)
+	{
+		jobsCondition.wait(jobsGuard, [this]
+		{
+			return !jobs.empty() || stopping;
+		});
+		if(stopping)
+		{
+			return;
+		}
+
+		// the job stays queued until all its chunks are taken, so that idle workers keep joining it
+		std::shared_ptr<Job> job = jobs.front();
+		if(job->nextChunk.load() >= job->nbChunks)
+		{
+			jobs.pop_front();
+			continue;
+		}
+		jobsGuard.unlock();
+		runChunks(*job);
+		jobsGuard.lock();
+	}
+}
+
+void norlab_icp_mapper::ThreadPool::runChunks(Job& job)
+{
+	int chunk;
+	while((chunk = job.nextChunk.fetch_add(1)) < job.nbChunks)
+	{
+		try
+		{
+			job.runRange(chunk * job.chunkSize, std::min(job.nbItems, (chunk + 1) * job.chunkSize));
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> exceptionGuard(job.exceptionLock);
+			if(!job.exception)
+			{
+				job.exception = std::current_exception();
+			}
+		}
+
+		if(job.nbCompletedChunks.fetch_add(1) + 1 == job.nbChunks)
+		{
+			completionLock.lock();
+			completionLock.unlock();
+			completionCondition.notify_all();
+		}
+	}
+}
+
+void norlab_icp_mapper::ThreadPool::run(const std::shared_ptr<Job>& job)
+{
+	jobsLock.lock();
+	jobs.push_back(job);
+	jobsLock.unlock();
+	jobsCondition.notify_all();
+
+	runChunks(*job);
+
+	std::unique_lock<std::mutex> completionGuard(completionLock);
+	completionCondition.wait(completionGuard, [&job]
+	{
+		return job->nbCompletedChunks.load() == job->nbChunks;
+	});
+	completionGuard.unlock();
+
+	if(job->exception)
+	{
+		std::rethrow_exception(job->exception);
+	}
+}
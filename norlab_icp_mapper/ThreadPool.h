@@ -0,0 +1,94 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace norlab_icp_mapper
+{
+	// Fixed set of worker threads shared by the data-parallel loops of the mapper. The calling thread runs chunks of its own loop as well, so
+	// loops can be nested or started from a worker without deadlocking when all the workers are busy.
+	class ThreadPool
+	{
+	private:
+		typedef struct Job
+		{
+			std::function<void(const int&, const int&)> runRange;
+			int nbItems;
+			int chunkSize;
+			int nbChunks;
+			std::atomic_int nextChunk;
+			std::atomic_int nbCompletedChunks;
+			std::mutex exceptionLock;
+			std::exception_ptr exception;
+		} Job;
+
+		std::vector<std::thread> workers;
+		std::deque<std::shared_ptr<Job>> jobs;
+		std::mutex jobsLock;
+		std::condition_variable jobsCondition;
+		std::mutex completionLock;
+		std::condition_variable completionCondition;
+		bool stopping;
+
+		void workerFunction();
+		void runChunks(Job& job);
+		void run(const std::shared_ptr<Job>& job);
+
+	public:
+		// a number of threads of 0 uses all the hardware threads, the calling thread being counted as one of them
+		ThreadPool(const int& nbThreads);
+		~ThreadPool();
+		int getNbThreads() const;
+
+		// call function on every index in [0, nbItems), split in contiguous chunks over the threads, exceptions being rethrown in the caller
+		template<typename Function>
+		void parallelFor(const int& nbItems, const Function& function)
+		{
+			const int nbThreads = std::min<int>(getNbThreads(), nbItems);
+			if(nbThreads <= 1)
+			{
+				for(int i = 0; i < nbItems; i++)
+				{
+					function(i);
+				}
+				return;
+			}
+
+			std::shared_ptr<Job> job = std::make_shared<Job>();
+			job->runRange = [&function](const int& begin, const int& end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					function(i);
+				}
+			};
+			job->nbItems = nbItems;
+			job->chunkSize = (nbItems + nbThreads - 1) / nbThreads;
+			job->nbChunks = (nbItems + job->chunkSize - 1) / job->chunkSize;
+			job->nextChunk.store(0);
+			job->nbCompletedChunks.store(0);
+			run(job);
+		}
+
+		// call function on the [begin, end) blocks of blockSize indices covering [0, nbItems), so that small loops stay on the calling thread
+		template<typename Function>
+		void parallelForBlocks(const int& nbItems, const int& blockSize, const Function& function)
+		{
+			parallelFor((nbItems + blockSize - 1) / blockSize, [&](const int& i)
+			{
+				function(i * blockSize, std::min(nbItems, (i + 1) * blockSize));
+			});
+		}
+	};
+}
+
+#endif
@@ -2,18 +2,54 @@
 #include <pointmatcher/PointMatcher.h>
 
 Trajectory::Trajectory(int dimension):
-		dimension(dimension)
+		dimension(dimension),
+		snapshot(std::make_shared<const Snapshot>(Snapshot{{}, 0}))
 {
 }
 
+Trajectory::Trajectory(const Trajectory& other):
+		dimension(other.dimension),
+		snapshot(std::make_shared<const Snapshot>(Snapshot{{}, 0}))
+{
+	*this = other;
+}
+
+Trajectory& Trajectory::operator=(const Trajectory& other)
+{
+	// chunks are copied, so that appending to the copy does not write in the chunks of the original
+	std::shared_ptr<const Snapshot> otherSnapshot = std::atomic_load(&other.snapshot);
+	std::shared_ptr<Snapshot> newSnapshot = std::make_shared<Snapshot>(Snapshot{{}, otherSnapshot->nbPoints});
+	for(int i = 0; i < otherSnapshot->chunks.size(); i++)
+	{
+		// columns past the number of points of the snapshot may be written concurrently
+		const int nbChunkPoints = std::min(CHUNK_SIZE, otherSnapshot->nbPoints - i * CHUNK_SIZE);
+		std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>(other.dimension, CHUNK_SIZE);
+		chunk->leftCols(nbChunkPoints) = otherSnapshot->chunks[i]->leftCols(nbChunkPoints);
+		newSnapshot->chunks.push_back(chunk);
+	}
+	dimension = other.dimension;
+	std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(newSnapshot));
+	return *this;
+}
+
 void Trajectory::addPoint(Eigen::VectorXf point)
 {
-	points.conservativeResize(dimension, points.cols() + 1);
-	points.col(points.cols() - 1) = point;
+	std::shared_ptr<const Snapshot> currentSnapshot = std::atomic_load(&snapshot);
+	std::shared_ptr<Snapshot> newSnapshot = std::make_shared<Snapshot>(*currentSnapshot);
+	if(newSnapshot->nbPoints % CHUNK_SIZE == 0)
+	{
+		newSnapshot->chunks.push_back(std::make_shared<Chunk>(dimension, CHUNK_SIZE));
+	}
+
+	// readers never look past the number of points of their snapshot, so the new column can be written in place
+	newSnapshot->chunks.back()->col(newSnapshot->nbPoints % CHUNK_SIZE) = point;
+	newSnapshot->nbPoints++;
+	std::atomic_store(&snapshot, std::shared_ptr<const Snapshot>(newSnapshot));
 }
 
 void Trajectory::save(std::string filename) const
 {
+	const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> points = getPoints();
 	PointMatcher<float>::DataPoints trajectory;
 	trajectory.addFeature("x", points.row(0));
 	trajectory.addFeature("y", points.row(1));
@@ -26,5 +62,23 @@ void Trajectory::save(std::string filename) const
 
 void Trajectory::clearPoints()
 {
-	points.conservativeResize(0, 0);
+	std::atomic_store(&snapshot, std::make_shared<const Snapshot>(Snapshot{{}, 0}));
+}
+
+int Trajectory::getNbPoints() const
+{
+	return std::atomic_load(&snapshot)->nbPoints;
+}
+
+Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> Trajectory::getPoints(int startIndex) const
+{
+	std::shared_ptr<const Snapshot> currentSnapshot = std::atomic_load(&snapshot);
+	startIndex = std::max(0, std::min(startIndex, currentSnapshot->nbPoints));
+
+	Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> points(dimension, currentSnapshot->nbPoints - startIndex);
+	for(int i = startIndex; i < currentSnapshot->nbPoints; i++)
+	{
+		points.col(i - startIndex) = currentSnapshot->chunks[i / CHUNK_SIZE]->col(i % CHUNK_SIZE);
+	}
+	return points;
 }
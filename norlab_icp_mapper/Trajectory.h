@@ -2,18 +2,37 @@
 #define TRAJECTORY_H
 
 #include <Eigen/Dense>
+#include <memory>
+#include <vector>
 
+// Points are stored in fixed-size chunks which are never reallocated, and readers work on an immutable snapshot of the chunk list. The const
+// methods can therefore run concurrently with addPoint and clearPoints without locking, while these two have to be serialized by the caller.
 class Trajectory
 {
 public:
 	Trajectory(int dimension);
+	Trajectory(const Trajectory& other);
+	Trajectory& operator=(const Trajectory& other);
 	void addPoint(Eigen::VectorXf point);
 	void save(std::string filename) const;
 	void clearPoints();
+	int getNbPoints() const;
+	// points from startIndex to the last one, one per column
+	Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> getPoints(int startIndex = 0) const;
 
 private:
+	typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> Chunk;
+
+	typedef struct Snapshot
+	{
+		std::vector<std::shared_ptr<Chunk>> chunks;
+		int nbPoints;
+	} Snapshot;
+
+	const int CHUNK_SIZE = 1024;
+
 	int dimension;
-	Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> points;
+	std::shared_ptr<const Snapshot> snapshot;
 };
 
 #endif
@@ -0,0 +1,124 @@
+#include "VoxelHash.h"
+
+norlab_icp_mapper::VoxelHash::VoxelHash(const float& voxelSize):
+		voxelSize(voxelSize),
+		nbVoxels(0)
+{
+}
+
+void norlab_icp_mapper::VoxelHash::clear()
+{
+	voxelKeys.clear();
+	voxelFirstPoints.clear();
+	nextPoints.clear();
+	nbVoxels = 0;
+}
+
+void norlab_icp_mapper::VoxelHash::indexNewPoints(const PM::Matrix& features)
+{
+	if(voxelSize <= 0)
+	{
+		return;
+	}
+
+	const int euclideanDim = features.rows() - 1;
+	for(int i = nextPoints.size(); i < features.cols(); i++)
+	{
+		if(2 * (nbVoxels + 1) > voxelKeys.size())
+		{
+			grow();
+		}
+
+		const int row = std::floor(features(0, i) / voxelSize);
+		const int column = std::floor(features(1, i) / voxelSize);
+		const int aisle = euclideanDim == 3 ? std::floor(features(2, i) / voxelSize) : 0;
+		const CellId voxelKey = toCellId(row, column, aisle);
+
+		const int slot = findSlot(voxelKey);
+		if(voxelFirstPoints[slot] == EMPTY_VOXEL)
+		{
+			voxelKeys[slot] = voxelKey;
+			nbVoxels++;
+		}
+		nextPoints.push_back(voxelFirstPoints[slot]);
+		voxelFirstPoints[slot] = i;
+	}
+}
+
+template<int EuclideanDim>
+bool norlab_icp_mapper::VoxelHash::containsPointWithinRange(const PM::Matrix& features, const PM::Matrix& queryFeatures, const int& queryPointId,
+															const float& range) const
+{
+	if(nbVoxels == 0)
+	{
+		return false;
+	}
+
+	const Eigen::Matrix<float, EuclideanDim, 1> queryPoint = queryFeatures.col(queryPointId).template head<EuclideanDim>();
+	const int voxelRange = std::ceil(range / voxelSize);
+	const int row = std::floor(queryPoint(0) / voxelSize);
+	const int column = std::floor(queryPoint(1) / voxelSize);
+	const int aisle = EuclideanDim == 3 ? std::floor(queryPoint(EuclideanDim - 1) / voxelSize) : 0;
+	const int aisleRange = EuclideanDim == 3 ? voxelRange : 0;
+	const float squaredRange = range * range;
+
+	for(int i = row - voxelRange; i <= row + voxelRange; i++)
+	{
+		for(int j = column - voxelRange; j <= column + voxelRange; j++)
+		{
+			for(int k = aisle - aisleRange; k <= aisle + aisleRange; k++)
+			{
+				// voxel keys can collide, so the distance to every point of the chain is checked
+				for(int pointId = voxelFirstPoints[findSlot(toCellId(i, j, k))]; pointId != EMPTY_VOXEL; pointId = nextPoints[pointId])
+				{
+					if((features.col(pointId).template head<EuclideanDim>() - queryPoint).squaredNorm() < squaredRange)
+					{
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+template bool norlab_icp_mapper::VoxelHash::containsPointWithinRange<2>(const PM::Matrix& features, const PM::Matrix& queryFeatures,
+																	  const int& queryPointId, const float& range) const;
+template bool norlab_icp_mapper::VoxelHash::containsPointWithinRange<3>(const PM::Matrix& features, const PM::Matrix& queryFeatures,
+																	  const int& queryPointId, const float& range) const;
+
+int norlab_icp_mapper::VoxelHash::getNbPoints() const
+{
+	return nextPoints.size();
+}
+
+int norlab_icp_mapper::VoxelHash::findSlot(const CellId& voxelKey) const
+{
+	const std::uint64_t slotMask = voxelKeys.size() - 1;
+	int slot = CellIdHash()(voxelKey) & slotMask;
+	while(voxelFirstPoints[slot] != EMPTY_VOXEL && voxelKeys[slot] != voxelKey)
+	{
+		slot = (slot + 1) & slotMask;
+	}
+	return slot;
+}
+
+void norlab_icp_mapper::VoxelHash::grow()
+{
+	std::vector<CellId> oldVoxelKeys;
+	std::vector<int> oldVoxelFirstPoints;
+	oldVoxelKeys.swap(voxelKeys);
+	oldVoxelFirstPoints.swap(voxelFirstPoints);
+
+	voxelKeys.resize(std::max<std::size_t>(2 * oldVoxelKeys.size(), 1024));
+	voxelFirstPoints.assign(voxelKeys.size(), EMPTY_VOXEL);
+	for(int i = 0; i < oldVoxelKeys.size(); i++)
+	{
+		if(oldVoxelFirstPoints[i] != EMPTY_VOXEL)
+		{
+			const int slot = findSlot(oldVoxelKeys[i]);
+			voxelKeys[slot] = oldVoxelKeys[i];
+			voxelFirstPoints[slot] = oldVoxelFirstPoints[i];
+		}
+	}
+}
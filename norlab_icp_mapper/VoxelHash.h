@@ -0,0 +1,37 @@
+#ifndef VOXEL_HASH_H
+#define VOXEL_HASH_H
+
+#include <pointmatcher/PointMatcher.h>
+#include "CellId.h"
+
+namespace norlab_icp_mapper
+{
+	// Spatial hash of the columns of a feature matrix. Points are chained per voxel, so indexing new points does not move the indexed ones.
+	// A voxel size of 0 leaves the hash empty, since no point can be closer than a range of 0.
+	class VoxelHash
+	{
+	private:
+		typedef PointMatcher<float> PM;
+
+		const int EMPTY_VOXEL = -1;
+
+		float voxelSize;
+		std::vector<CellId> voxelKeys;
+		std::vector<int> voxelFirstPoints;
+		std::vector<int> nextPoints;
+		int nbVoxels;
+
+		int findSlot(const CellId& voxelKey) const;
+		void grow();
+
+	public:
+		VoxelHash(const float& voxelSize);
+		void clear();
+		void indexNewPoints(const PM::Matrix& features);
+		template<int EuclideanDim>
+		bool containsPointWithinRange(const PM::Matrix& features, const PM::Matrix& queryFeatures, const int& queryPointId, const float& range) const;
+		int getNbPoints() const;
+	};
+}
+
+#endif